@@ -0,0 +1,410 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+* Headless benchmark of the epoching and statistics engine (ERPEngine), driven with synthetic
+* multichannel data and TTL trains, so it can be profiled and rigs can be sized without
+* launching the GUI.
+*
+* Usage: ERPBenchmark [--channels=64] [--rate=30000] [--window=0.5] [--pre=0] [--trigger-rate=5]
+*                     [--triggers=2] [--block=1024] [--seconds=30] [--alpha=0] [--threads=0|1]
+*                     [--archive=<file>]
+*
+* Reports time per sample-channel, per-block latency percentiles and the heap allocations
+* made while processing (which should be none), and how the time splits between folding
+* samples into epochs and the statistics. With --archive, every epoch is also written to the
+* given file by an EpochArchive, which shows what archiving costs the processing thread; the
+* archive is then replayed (ERPEngine::replay) to time re-averaging and check that it gives
+* the same statistics as the live run.
+*/
+
+#include "ERPEngine.h"
+#include "ProcessTimings.h"
+#include "SimdKernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace RealTimeERP;
+
+/*********** Allocation counting ***********/
+
+static std::atomic<uint64_t> numAllocations(0);
+static std::atomic<uint64_t> numBytesAllocated(0);
+
+void* operator new(size_t size)
+{
+    numAllocations.fetch_add(1, std::memory_order_relaxed);
+    numBytesAllocated.fetch_add(size, std::memory_order_relaxed);
+    void* p = std::malloc(size > 0 ? size : 1);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+/*********** Options ***********/
+
+struct Options
+{
+    int channels = 64;
+    double sampleRate = 30000;
+    double window = 0.5;      // seconds after the trigger
+    double pre = 0;           // seconds before the trigger
+    double triggerRate = 5;   // per trigger, Hz
+    int triggers = 2;
+    int blockSize = 1024;
+    double seconds = 30;      // of simulated data
+    double alpha = 0;
+    bool threads = false;
+    std::string archivePath;  // empty: don't archive
+};
+
+static bool parseOption(const char* arg, const char* name, double& value)
+{
+    size_t len = std::strlen(name);
+    if (std::strncmp(arg, name, len) == 0 && arg[len] == '=')
+    {
+        value = std::atof(arg + len + 1);
+        return true;
+    }
+    return false;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        double v;
+        if (parseOption(argv[i], "--channels", v))          { options.channels = int(v); }
+        else if (parseOption(argv[i], "--rate", v))         { options.sampleRate = v; }
+        else if (parseOption(argv[i], "--window", v))       { options.window = v; }
+        else if (parseOption(argv[i], "--pre", v))          { options.pre = v; }
+        else if (parseOption(argv[i], "--trigger-rate", v)) { options.triggerRate = v; }
+        else if (parseOption(argv[i], "--triggers", v))     { options.triggers = int(v); }
+        else if (parseOption(argv[i], "--block", v))        { options.blockSize = int(v); }
+        else if (parseOption(argv[i], "--seconds", v))      { options.seconds = v; }
+        else if (parseOption(argv[i], "--alpha", v))        { options.alpha = v; }
+        else if (parseOption(argv[i], "--threads", v))      { options.threads = v != 0; }
+        else if (std::strncmp(argv[i], "--archive=", 10) == 0) { options.archivePath = argv[i] + 10; }
+        else
+        {
+            std::printf("Unknown option %s\n\n"
+                "Usage: ERPBenchmark [--channels=64] [--rate=30000] [--window=0.5] [--pre=0]\n"
+                "                    [--trigger-rate=5] [--triggers=2] [--block=1024] [--seconds=30]\n"
+                "                    [--alpha=0] [--threads=0|1] [--archive=<file>]\n", argv[i]);
+            return false;
+        }
+    }
+
+    return options.channels > 0 && options.sampleRate > 0 && options.window > 0
+        && options.triggers > 0 && options.blockSize > 0 && options.seconds > 0;
+}
+
+/*********** Replay ***********/
+
+// Re-averages the archive with a second engine and compares its statistics with the live ones
+static void replayArchive(const Options& options, const ERPEngine& live, int epochSamples, int preSamples)
+{
+    EpochArchiveReader reader;
+    if (!reader.open(options.archivePath))
+    {
+        std::printf("replay:          couldn't read %s\n", options.archivePath.c_str());
+        return;
+    }
+
+    ERPEngine engine;
+    engine.configure(options.triggers, options.channels, epochSamples, preSamples, 0, options.alpha);
+    if (options.threads)
+    {
+        engine.startWorkers();
+    }
+
+    std::vector<int> channelMap(options.channels);
+    for (int n = 0; n < options.channels; ++n)
+    {
+        channelMap[n] = n;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    engine.replay(reader, channelMap);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Only completed epochs count towards the statistics, so they should match the live run
+    // (up to rounding, since live epochs are summed slice by slice)
+    const AccumulatorStore& liveStats = live.getAverages().stats;
+    const AccumulatorStore& replayStats = engine.getAverages().stats;
+    double maxDifference = 0;
+    for (int t = 0; t < options.triggers; ++t)
+    {
+        for (int n = 0; n < options.channels; ++n)
+        {
+            for (int stat = 0; stat < ERPSnapshot::NUM_STATISTICS; ++stat)
+            {
+                double a = liveStats.getAverage(t, n, stat);
+                double b = replayStats.getAverage(t, n, stat);
+                maxDifference = std::max(maxDifference, std::abs(a - b) / std::max(1.0, std::abs(a)));
+            }
+        }
+    }
+
+    std::printf("replay:          %llu epochs in %.3f s (%.0f epochs/s, %.2f GB/s), %d workers, "
+        "statistics within %.2g of the live run\n",
+        (unsigned long long)reader.getNumRecords(), seconds, reader.getNumRecords() / seconds,
+        reader.getNumRecords() * double(options.channels) * epochSamples * sizeof(float) / seconds / 1e9,
+        engine.getNumWorkers(), maxDifference);
+}
+
+/*********** Synthetic data ***********/
+
+// A few blocks of noise plus a slow oscillation per channel, cycled through while benchmarking
+// so that generating data doesn't count
+struct SyntheticStream
+{
+    static const int numBlocks = 8;
+
+    SyntheticStream(const Options& options)
+        : blockSize (options.blockSize)
+        , data      (size_t(numBlocks) * options.channels * options.blockSize)
+        , pointers  (options.channels)
+    {
+        std::mt19937 rng(1234);
+        std::normal_distribution<float> noise(0, 20);
+        for (int c = 0; c < options.channels; ++c)
+        {
+            float* channel = getChannel(c);
+            double phase = c * 0.1;
+            for (int i = 0; i < numBlocks * blockSize; ++i)
+            {
+                channel[i] = float(50 * std::sin(2 * M_PI * 8 * i / options.sampleRate + phase)) + noise(rng);
+            }
+        }
+    }
+
+    float* getChannel(int c) { return data.data() + size_t(c) * numBlocks * blockSize; }
+
+    const float* const* getBlock(int index)
+    {
+        int offset = (index % numBlocks) * blockSize;
+        for (size_t c = 0; c < pointers.size(); ++c)
+        {
+            pointers[c] = getChannel(int(c)) + offset;
+        }
+        return pointers.data();
+    }
+
+    int blockSize;
+    std::vector<float> data; // channel x sample
+    std::vector<const float*> pointers;
+};
+
+/*********** Main ***********/
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t index = std::min(sorted.size() - 1, size_t(p / 100 * sorted.size()));
+    return sorted[index];
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return 1;
+    }
+
+    int epochSamples = int(options.sampleRate * (options.window + options.pre));
+    int preSamples = int(options.sampleRate * options.pre);
+    int numBlocks = int(options.seconds * options.sampleRate / options.blockSize);
+    int numWarmupBlocks = std::min(numBlocks / 10, 100);
+
+    ERPEngine engine;
+    engine.configure(options.triggers, options.channels, epochSamples, preSamples,
+        int(options.sampleRate * 0.05), options.alpha);
+    if (options.threads)
+    {
+        engine.startWorkers();
+    }
+
+    EpochArchive archive;
+    if (!options.archivePath.empty())
+    {
+        std::vector<int> channels(options.channels);
+        for (int n = 0; n < options.channels; ++n)
+        {
+            channels[n] = n;
+        }
+        if (!archive.open(options.archivePath, options.triggers, channels, epochSamples, preSamples,
+            options.sampleRate, engine.getMaxOpenEpochs()))
+        {
+            std::printf("Couldn't create %s\n", options.archivePath.c_str());
+            return 1;
+        }
+        if (archive.isBufferLimited())
+        {
+            std::printf("Archive has %d epoch buffers for up to %d open epochs; overlapping epochs may not be archived\n",
+                archive.getNumBuffers(), engine.getMaxOpenEpochs());
+        }
+        engine.setArchive(&archive);
+    }
+
+    SyntheticStream stream(options);
+
+    // split of the time between folding and statistics (measured blocks only)
+    ProcessTimings timings;
+
+    // TTL trains: one per trigger at the trigger rate, staggered and jittered by up to 10%
+    std::mt19937 rng(42);
+    double period = options.sampleRate / options.triggerRate;
+    std::uniform_real_distribution<double> jitter(-0.1 * period, 0.1 * period);
+    std::vector<double> nextEvent(options.triggers);
+    for (int t = 0; t < options.triggers; ++t)
+    {
+        nextEvent[t] = period * (t + 1) / options.triggers;
+    }
+
+    std::vector<double> latencies(numBlocks - numWarmupBlocks); // ns
+    struct PendingEvent
+    {
+        int trigger;
+        int64_t timestamp;
+    };
+    std::vector<PendingEvent> blockEvents(size_t(options.triggers) * 64);
+    uint64_t numEvents = 0;
+    uint64_t numEpochs = 0;
+    uint64_t allocationsBefore = 0;
+    uint64_t bytesBefore = 0;
+
+    for (int b = 0; b < numBlocks; ++b)
+    {
+        if (b == numWarmupBlocks)
+        {
+            engine.setTimings(&timings);
+            allocationsBefore = numAllocations.load();
+            bytesBefore = numBytesAllocated.load();
+        }
+
+        int64_t timestamp = int64_t(b) * options.blockSize;
+        int64_t blockEnd = timestamp + options.blockSize;
+
+        // (precomputed so the RNG isn't timed)
+        int numBlockEvents = 0;
+        for (int t = 0; t < options.triggers; ++t)
+        {
+            while (nextEvent[t] < blockEnd && numBlockEvents < int(blockEvents.size()))
+            {
+                blockEvents[numBlockEvents].trigger = t;
+                blockEvents[numBlockEvents].timestamp = int64_t(nextEvent[t]);
+                ++numBlockEvents;
+                nextEvent[t] += period + jitter(rng);
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (int e = 0; e < numBlockEvents; ++e)
+        {
+            engine.addEvent(blockEvents[e].trigger, blockEvents[e].timestamp);
+        }
+        numEpochs += engine.processBlock(stream.getBlock(b), options.blockSize, timestamp);
+
+        auto end = std::chrono::steady_clock::now();
+
+        numEvents += numBlockEvents;
+        if (b >= numWarmupBlocks)
+        {
+            latencies[b - numWarmupBlocks] = double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+    }
+
+    uint64_t allocations = numAllocations.load() - allocationsBefore;
+    uint64_t bytes = numBytesAllocated.load() - bytesBefore;
+
+    // (waits for the writer to catch up)
+    engine.setArchive(nullptr);
+    archive.close();
+
+    double total = 0;
+    for (double l : latencies)
+    {
+        total += l;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    double blockDurationNs = 1e9 * options.blockSize / options.sampleRate;
+    double sampleChannels = double(latencies.size()) * options.blockSize * options.channels;
+
+    uint64_t dropped = 0;
+    for (int t = 0; t < options.triggers; ++t)
+    {
+        dropped += engine.getNumDroppedEvents(t);
+    }
+
+    std::printf("channels %d, %.0f Hz, window %.3f s (+%.3f s pre), %d triggers at %.2f Hz, block %d, %d workers, %s\n",
+        options.channels, options.sampleRate, options.window, options.pre, options.triggers,
+        options.triggerRate, options.blockSize, engine.getNumWorkers(), Kernels::getInstructionSetName());
+    std::printf("blocks:          %zu (after %d warm-up)\n", latencies.size(), numWarmupBlocks);
+    std::printf("events:          %llu (%llu dropped), %llu epochs completed\n",
+        (unsigned long long)numEvents, (unsigned long long)dropped, (unsigned long long)numEpochs);
+    std::printf("ns/sample-chan:  %.3f\n", total / sampleChannels);
+    std::printf("block latency:   p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+        percentile(latencies, 50) / 1e3, percentile(latencies, 90) / 1e3, percentile(latencies, 99) / 1e3,
+        percentile(latencies, 99.9) / 1e3, latencies.back() / 1e3);
+    std::printf("real-time load:  %.2f%% of each block's duration on average, %.2f%% worst\n",
+        100 * total / latencies.size() / blockDurationNs, 100 * latencies.back() / blockDurationNs);
+    std::printf("allocations:     %llu (%llu bytes) while processing\n",
+        (unsigned long long)allocations, (unsigned long long)bytes);
+    if (!options.archivePath.empty())
+    {
+        std::printf("archive:         %llu epochs written, %llu dropped\n",
+            (unsigned long long)archive.getNumWritten(), (unsigned long long)archive.getNumDropped());
+        replayArchive(options, engine, epochSamples, preSamples);
+    }
+    std::printf("\nengine phases:\n");
+    std::fflush(stdout);
+    timings.writeSummary(std::cout);
+
+    return 0;
+}
@@ -0,0 +1,388 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+* Microbenchmarks of the reusable primitives: AtomicallyShared<T> (push/pull latency and how
+* often the reader gets fresh data while a writer is busy, for large payloads),
+* CircularArray::enqueueArray (throughput at different chunk lengths) and AccumulatorStore
+* (accumulate throughput with linear, exponential and instantaneous weighting, with and
+* without the variance, estimating the median and over a window of the last epochs).
+*
+* Usage: ERPMicrobenchmarks [--format=json|csv] [--seconds=0.5]
+*
+* Every case is one record with the same fields, so results from different builds and rigs
+* can be put side by side:
+*
+*     suite, name, size, iterations, ns_per_op, p50_ns, p99_ns, max_ns, items_per_sec, fresh_fraction
+*
+* Percentiles are of single operations where those are timed separately (0 otherwise), and
+* fresh_fraction is the fraction of AtomicallyShared pulls that found new data (0 otherwise).
+*/
+
+#include "AccumulatorStore.h"
+#include "AtomicSynchronizer.h"
+#include "CircularArray.h"
+#include "SimdKernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace RealTimeERP;
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedNs(Clock::time_point start, Clock::time_point end)
+{
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+/*********** Results ***********/
+
+struct Result
+{
+    std::string suite;
+    std::string name;
+    long long size;        // payload / chunk / epoch length, in elements
+    long long iterations;
+    double nsPerOp;
+    double p50Ns;
+    double p99Ns;
+    double maxNs;
+    double itemsPerSec;    // elements processed per second
+    double freshFraction;
+};
+
+// Fills in the percentiles from (and sorts) a list of per-operation times
+static void setPercentiles(Result& result, std::vector<double>& times)
+{
+    if (times.empty())
+    {
+        return;
+    }
+    std::sort(times.begin(), times.end());
+    result.p50Ns = times[times.size() / 2];
+    result.p99Ns = times[std::min(times.size() - 1, times.size() * 99 / 100)];
+    result.maxNs = times.back();
+}
+
+static void printResults(const std::vector<Result>& results, bool json)
+{
+    if (json)
+    {
+        std::printf("{\n  \"instruction_set\": \"%s\",\n  \"hardware_threads\": %u,\n  \"results\": [\n",
+            Kernels::getInstructionSetName(), std::thread::hardware_concurrency());
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& r = results[i];
+            std::printf("    {\"suite\": \"%s\", \"name\": \"%s\", \"size\": %lld, \"iterations\": %lld, "
+                "\"ns_per_op\": %.3f, \"p50_ns\": %.1f, \"p99_ns\": %.1f, \"max_ns\": %.1f, \"items_per_sec\": %.6g, \"fresh_fraction\": %.4f}%s\n",
+                r.suite.c_str(), r.name.c_str(), r.size, r.iterations, r.nsPerOp, r.p50Ns, r.p99Ns,
+                r.maxNs, r.itemsPerSec, r.freshFraction, i + 1 < results.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+    }
+    else
+    {
+        std::printf("suite,name,size,iterations,ns_per_op,p50_ns,p99_ns,max_ns,items_per_sec,fresh_fraction,instruction_set\n");
+        for (const Result& r : results)
+        {
+            std::printf("%s,%s,%lld,%lld,%.3f,%.1f,%.1f,%.1f,%.6g,%.4f,%s\n",
+                r.suite.c_str(), r.name.c_str(), r.size, r.iterations, r.nsPerOp, r.p50Ns, r.p99Ns,
+                r.maxNs, r.itemsPerSec, r.freshFraction, Kernels::getInstructionSetName());
+        }
+    }
+}
+
+/*********** AtomicallyShared ***********/
+
+// Writer fills and pushes payloads of `size` doubles as fast as it can while a reader keeps
+// pulling and summing the latest one. Times each push and each pull, and counts how many
+// pulls got a new payload.
+static void benchAtomicallyShared(int size, double seconds, std::vector<Result>& results)
+{
+    AtomicallyShared<std::vector<double>> shared(size, 0.0);
+
+    const size_t maxOps = 1 << 20;
+    std::vector<double> pushTimes;
+    std::vector<double> pullTimes;
+    pushTimes.reserve(maxOps);
+    pullTimes.reserve(maxOps);
+
+    std::atomic<bool> stop(false);
+    long long numPushes = 0;
+    long long numPulls = 0;
+    long long numFresh = 0;
+    double readerSum = 0;
+
+    // one initial write, so that the reader is valid
+    {
+        AtomicScopedWritePtr<std::vector<double>> writer(shared);
+        writer.pushUpdate();
+    }
+
+    std::thread reader([&]()
+        {
+            AtomicScopedReadPtr<std::vector<double>> readPtr(shared);
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                bool fresh = shared.hasUpdate();
+
+                auto start = Clock::now();
+                readPtr.pullUpdate();
+                auto end = Clock::now();
+
+                if (readPtr.isValid())
+                {
+                    const std::vector<double>& data = *readPtr;
+                    for (double x : data)
+                    {
+                        readerSum += x;
+                    }
+                }
+
+                if (pullTimes.size() < maxOps)
+                {
+                    pullTimes.push_back(elapsedNs(start, end));
+                }
+                ++numPulls;
+                numFresh += fresh;
+            }
+        });
+
+    auto benchStart = Clock::now();
+    double writeNs = 0;
+    while (elapsedNs(benchStart, Clock::now()) < seconds * 1e9)
+    {
+        auto writeStart = Clock::now();
+        AtomicScopedWritePtr<std::vector<double>> writer(shared);
+        std::vector<double>& data = *writer;
+        std::fill(data.begin(), data.end(), double(numPushes));
+
+        auto start = Clock::now();
+        writer.pushUpdate();
+        auto end = Clock::now();
+
+        writeNs += elapsedNs(writeStart, end);
+        if (pushTimes.size() < maxOps)
+        {
+            pushTimes.push_back(elapsedNs(start, end));
+        }
+        ++numPushes;
+    }
+    stop = true;
+    reader.join();
+
+    Result push = { "AtomicallyShared", "push", size, numPushes, 0, 0, 0, 0, 0, 0 };
+    push.nsPerOp = writeNs / std::max(1LL, numPushes); // including filling the payload
+    push.itemsPerSec = numPushes * double(size) / seconds;
+    setPercentiles(push, pushTimes);
+    results.push_back(push);
+
+    Result pull = { "AtomicallyShared", "pull", size, numPulls, 0, 0, 0, 0, 0, 0 };
+    pull.nsPerOp = seconds * 1e9 / std::max(1LL, numPulls); // including reading the payload
+    pull.itemsPerSec = numPulls * double(size) / seconds;
+    pull.freshFraction = numPulls > 0 ? double(numFresh) / numPulls : 0;
+    setPercentiles(pull, pullTimes);
+    results.push_back(pull);
+
+    if (readerSum < 0)
+    {
+        std::printf("%f", readerSum); // (keep the reads)
+    }
+}
+
+/*********** CircularArray ***********/
+
+// Enqueues chunks of `chunk` samples into a ring of `ringLength` samples
+static void benchEnqueueArray(int ringLength, int chunk, double seconds, std::vector<Result>& results)
+{
+    CircularArray<float> ring(ringLength);
+    std::vector<float> source(chunk);
+    for (int i = 0; i < chunk; ++i)
+    {
+        source[i] = float(i);
+    }
+
+    const size_t maxOps = 1 << 20;
+    std::vector<double> times;
+    times.reserve(maxOps);
+
+    long long numOps = 0;
+    auto benchStart = Clock::now();
+    double totalNs = 0;
+    while (totalNs < seconds * 1e9)
+    {
+        // batch short chunks so the clock doesn't dominate
+        const int batch = std::max(1, 4096 / chunk);
+        auto start = Clock::now();
+        for (int b = 0; b < batch; ++b)
+        {
+            ring.enqueueArray(source.data(), chunk);
+        }
+        auto end = Clock::now();
+
+        if (times.size() < maxOps)
+        {
+            times.push_back(elapsedNs(start, end) / batch);
+        }
+        numOps += batch;
+        totalNs = elapsedNs(benchStart, end);
+    }
+
+    Result result = { "CircularArray", "enqueueArray_ring" + std::to_string(ringLength), chunk, numOps, 0, 0, 0, 0, 0, 0 };
+    result.nsPerOp = totalNs / numOps;
+    result.itemsPerSec = numOps * double(chunk) / (totalNs / 1e9);
+    setPercentiles(result, times);
+    results.push_back(result);
+
+    if (ring[0] < 0)
+    {
+        std::printf("%f", ring[0]);
+    }
+}
+
+/*********** AccumulatorStore ***********/
+
+// Adds whole epochs of `epochLength` samples on `numChannels` channels with the given
+// weighting, one slice per channel as the engine does (estimating a quantile instead of
+// the mean if quantile >= 0, or averaging only the last `window` epochs if window > 0)
+static void benchAccumulate(const char* name, double alpha, bool replace, bool withVariance,
+    int numChannels, int epochLength, double seconds, std::vector<Result>& results,
+    double quantile = -1, int window = 0)
+{
+    AccumulatorStore store;
+    store.resize(1, numChannels, epochLength, alpha, withVariance);
+    store.setQuantile(quantile);
+    store.setWindow(window);
+
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0, 50);
+    std::vector<float> epoch(epochLength);
+    for (float& x : epoch)
+    {
+        x = noise(rng);
+    }
+
+    std::vector<double> times;
+    times.reserve(1 << 16);
+
+    long long numEpochs = 0;
+    auto benchStart = Clock::now();
+    double totalNs = 0;
+    while (totalNs < seconds * 1e9)
+    {
+        auto start = Clock::now();
+        uint64_t number = store.getNumEpochs(0);
+        double gain = store.beginEpoch(0, replace);
+        for (int c = 0; c < numChannels; ++c)
+        {
+            store.addSlice(0, c, 0, epoch.data(), epochLength, gain, 0, number);
+        }
+        auto end = Clock::now();
+
+        if (times.size() < times.capacity())
+        {
+            times.push_back(elapsedNs(start, end));
+        }
+        ++numEpochs;
+        totalNs = elapsedNs(benchStart, end);
+    }
+
+    // per-op figures are per epoch (all channels), items are samples x channels
+    Result result = { "AccumulatorStore", name, epochLength, numEpochs, 0, 0, 0, 0, 0, 0 };
+    result.nsPerOp = totalNs / numEpochs;
+    result.itemsPerSec = numEpochs * double(epochLength) * numChannels / (totalNs / 1e9);
+    setPercentiles(result, times);
+    results.push_back(result);
+
+    if (store.getAverage(0, 0, 0) > 1e30)
+    {
+        std::printf("%f", store.getAverage(0, 0, 0));
+    }
+}
+
+/*********** Main ***********/
+
+int main(int argc, char* argv[])
+{
+    bool json = true;
+    double seconds = 0.5;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--format=json") == 0)
+        {
+            json = true;
+        }
+        else if (std::strcmp(argv[i], "--format=csv") == 0)
+        {
+            json = false;
+        }
+        else if (std::strncmp(argv[i], "--seconds=", 10) == 0 && std::atof(argv[i] + 10) > 0)
+        {
+            seconds = std::atof(argv[i] + 10);
+        }
+        else
+        {
+            std::fprintf(stderr, "Unknown option %s\n\nUsage: ERPMicrobenchmarks [--format=json|csv] [--seconds=0.5]\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+
+    // a few hundred kB to tens of MB, i.e. a small to a very large ERP snapshot
+    for (int size : { 1 << 12, 1 << 16, 1 << 20, 1 << 22 })
+    {
+        benchAtomicallyShared(size, seconds, results);
+    }
+
+    for (int chunk : { 16, 64, 256, 1024, 4096, 16384 })
+    {
+        benchEnqueueArray(1 << 15, chunk, seconds, results);
+    }
+
+    for (int epochLength : { 1000, 30000 })
+    {
+        benchAccumulate("linear", 0, false, false, 64, epochLength, seconds, results);
+        benchAccumulate("exponential", 0.1, false, false, 64, epochLength, seconds, results);
+        benchAccumulate("instantaneous", 0, true, false, 64, epochLength, seconds, results);
+        benchAccumulate("linear_variance", 0, false, true, 64, epochLength, seconds, results);
+        benchAccumulate("exponential_variance", 0.1, false, true, 64, epochLength, seconds, results);
+        benchAccumulate("linear_median", 0, false, true, 64, epochLength, seconds, results, 0.5);
+        benchAccumulate("exponential_median", 0.1, false, true, 64, epochLength, seconds, results, 0.5);
+        benchAccumulate("window", 0, false, false, 64, epochLength, seconds, results, -1, 20);
+        benchAccumulate("window_variance", 0, false, true, 64, epochLength, seconds, results, -1, 20);
+    }
+
+    printResults(results, json);
+    return 0;
+}
@@ -0,0 +1,307 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "AccumulatorStore.h"
+#include "SimdKernels.h"
+
+#include <algorithm>
+
+using namespace RealTimeERP;
+
+// doubles per 64-byte cache line
+static const size_t lineDoubles = 64 / sizeof(double);
+
+AccumulatorStore::AccumulatorStore()
+    : numTriggers   (0)
+    , numChannels   (0)
+    , numSamples    (0)
+    , rowStride     (0)
+    , triggerStride (0)
+    , alpha         (0)
+    , decay         (1)
+    , quantile      (-1)
+    , windowLength  (0)
+    , version       (0)
+{}
+
+void AccumulatorStore::resize(int nTriggers, int nChannels, int nSamples, double a, bool withVariance)
+{
+    numTriggers = std::max(0, nTriggers);
+    numChannels = std::max(0, nChannels);
+    numSamples = std::max(0, nSamples);
+    rowStride = (size_t(numSamples) + lineDoubles - 1) / lineDoubles * lineDoubles;
+    triggerStride = numChannels * rowStride;
+
+    alpha = a;
+    decay = 1 - alpha;
+    quantile = -1;
+    windowLength = 0;
+
+    averages.assign(numTriggers * triggerStride, 0.0);
+    m2.assign(withVariance ? averages.size() : 0, 0.0);
+    weights.assign(numTriggers, 0.0);
+    squaredWeights.assign(numTriggers, 0.0);
+    windowEpochs.clear();
+    epochNumbers.assign(numTriggers, 0);
+    validSamples.assign(numTriggers, 0);
+    versions.assign(numTriggers, 0);
+    version = 0;
+}
+
+AccumulatorStore& AccumulatorStore::operator=(const AccumulatorStore& other)
+{
+    if (this != &other)
+    {
+        numTriggers = other.numTriggers;
+        numChannels = other.numChannels;
+        numSamples = other.numSamples;
+        rowStride = other.rowStride;
+        triggerStride = other.triggerStride;
+        alpha = other.alpha;
+        decay = other.decay;
+        quantile = other.quantile;
+        windowLength = other.windowLength;
+
+        // vector assignment reuses the existing allocation when it is big enough
+        averages = other.averages;
+        m2 = other.m2;
+        weights = other.weights;
+        squaredWeights = other.squaredWeights;
+        windowEpochs.clear(); // (only needed for adding epochs)
+        epochNumbers = other.epochNumbers;
+        validSamples = other.validSamples;
+        versions = other.versions;
+        version = other.version;
+    }
+    return *this;
+}
+
+void AccumulatorStore::copyChangedFrom(const AccumulatorStore& other)
+{
+    if (numTriggers != other.numTriggers || numChannels != other.numChannels
+        || numSamples != other.numSamples || alpha != other.alpha
+        || hasVariance() != other.hasVariance() || quantile != other.quantile
+        || windowLength != other.windowLength)
+    {
+        *this = other;
+        return;
+    }
+
+    if (version == other.version)
+    {
+        return;
+    }
+
+    for (int t = 0; t < numTriggers; ++t)
+    {
+        if (versions[t] != other.versions[t])
+        {
+            int valid = other.validSamples[t];
+            if (valid == numSamples)
+            {
+                const double* src = other.averages.data() + t * triggerStride;
+                std::copy(src, src + triggerStride, averages.data() + t * triggerStride);
+                if (hasVariance())
+                {
+                    const double* srcM2 = other.m2.data() + t * triggerStride;
+                    std::copy(srcM2, srcM2 + triggerStride, m2.data() + t * triggerStride);
+                }
+            }
+            else
+            {
+                // the rest of each row is stale anyway
+                for (int c = 0; c < numChannels; ++c)
+                {
+                    const double* src = other.getAverages(t, c);
+                    std::copy(src, src + valid, getAverages(t, c));
+                    if (hasVariance())
+                    {
+                        const double* srcM2 = other.getM2(t, c);
+                        std::copy(srcM2, srcM2 + valid, getM2(t, c));
+                    }
+                }
+            }
+            weights[t] = other.weights[t];
+            squaredWeights[t] = other.squaredWeights[t];
+            epochNumbers[t] = other.epochNumbers[t];
+            validSamples[t] = valid;
+            versions[t] = other.versions[t];
+        }
+    }
+    version = other.version;
+}
+
+void AccumulatorStore::setQuantile(double q)
+{
+    quantile = hasVariance() && q >= 0 ? std::min(q, 1.0) : -1;
+    setWindow(windowLength); // a quantile keeps no epochs
+}
+
+void AccumulatorStore::setWindow(int numEpochs)
+{
+    windowLength = std::max(0, numEpochs);
+    size_t ringSize = windowLength > 0 && !isQuantile() ? numTriggers * windowLength * triggerStride : 0;
+    windowEpochs.assign(ringSize, 0.0f);
+    reset();
+}
+
+void AccumulatorStore::reset()
+{
+    for (int t = 0; t < numTriggers; ++t)
+    {
+        resetTrigger(t);
+    }
+}
+
+void AccumulatorStore::resetTrigger(int trigger)
+{
+    weights[trigger] = 0;
+    squaredWeights[trigger] = 0;
+    epochNumbers[trigger] = 0;
+    validSamples[trigger] = 0;
+    markChanged(trigger);
+}
+
+double AccumulatorStore::beginEpoch(int trigger, bool replace)
+{
+    uint64_t epoch = epochNumbers[trigger]++;
+    if (windowLength > 0 && !replace)
+    {
+        // every epoch in the window has weight 1
+        weights[trigger] = double(std::min<uint64_t>(epoch + 1, uint64_t(windowLength)));
+        squaredWeights[trigger] = weights[trigger];
+    }
+    else
+    {
+        weights[trigger] = replace ? 1.0 : 1 + decay * weights[trigger];
+        squaredWeights[trigger] = replace ? 1.0 : 1 + decay * decay * squaredWeights[trigger];
+    }
+    markChanged(trigger);
+    return 1 / weights[trigger];
+}
+
+void AccumulatorStore::addSlice(int trigger, int channel, int offset, const float* x, int n,
+    double gain, double shift, uint64_t epoch)
+{
+    addRow(trigger, channel, offset, x, n, gain, shift, epoch);
+    markAdded(trigger, offset, n);
+}
+
+void AccumulatorStore::addRow(int trigger, int channel, int offset, const float* x, int n,
+    double gain, double shift, uint64_t epoch)
+{
+    double* avg = getAverages(trigger, channel) + offset;
+    if (gain == 1)
+    {
+        // replace (possibly stale) data exactly
+        if (hasWindow())
+        {
+            // (rounded as the window will subtract it)
+            float* ring = getWindowRow(trigger, epoch, channel) + offset;
+            for (int i = 0; i < n; ++i)
+            {
+                ring[i] = float(x[i] - shift);
+                avg[i] = ring[i];
+            }
+        }
+        else
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                avg[i] = x[i] - shift;
+            }
+        }
+        if (hasVariance())
+        {
+            std::fill(getM2(trigger, channel) + offset, getM2(trigger, channel) + offset + n, 0.0);
+        }
+    }
+    else if (hasWindow())
+    {
+        Kernels::slideWindow(avg, hasVariance() ? getM2(trigger, channel) + offset : nullptr,
+            getWindowRow(trigger, epoch, channel) + offset, x, n, gain, epoch >= uint64_t(windowLength), shift);
+    }
+    else if (isQuantile())
+    {
+        Kernels::updateQuantile(avg, getM2(trigger, channel) + offset, x, n, gain, quantile, shift);
+    }
+    else if (hasVariance())
+    {
+        Kernels::accumulateWithVariance(avg, getM2(trigger, channel) + offset, x, n, gain, decay, shift);
+    }
+    else
+    {
+        Kernels::accumulate(avg, x, n, gain, shift);
+    }
+}
+
+void AccumulatorStore::markAdded(int trigger, int offset, int n)
+{
+    extendValid(trigger, offset, n);
+    markChanged(trigger);
+}
+
+void AccumulatorStore::addValue(int trigger, int channel, int sample, double x, double gain, uint64_t epoch)
+{
+    double& avg = getAverages(trigger, channel)[sample];
+    if ((isQuantile() || hasWindow()) && gain != 1)
+    {
+        float value = float(x);
+        double* dev = hasVariance() ? &getM2(trigger, channel)[sample] : nullptr;
+        if (isQuantile())
+        {
+            Kernels::updateQuantile(&avg, dev, &value, 1, gain, quantile);
+        }
+        else
+        {
+            Kernels::slideWindow(&avg, dev, getWindowRow(trigger, epoch, channel) + sample, &value, 1,
+                gain, epoch >= uint64_t(windowLength));
+        }
+        extendValid(trigger, sample, 1);
+        markChanged(trigger);
+        return;
+    }
+    if (hasWindow())
+    {
+        // first epoch in the window (gain 1), rounded as the window will subtract it
+        x = getWindowRow(trigger, epoch, channel)[sample] = float(x);
+    }
+
+    double d = x - avg;
+    if (hasVariance())
+    {
+        double& dev = getM2(trigger, channel)[sample];
+        dev = gain == 1 ? 0.0 : decay * dev + (1 - gain) * d * d;
+    }
+    avg = gain == 1 ? x : avg + gain * d;
+    extendValid(trigger, sample, 1);
+    markChanged(trigger);
+}
+
+void AccumulatorStore::extendValid(int trigger, int offset, int n)
+{
+    if (offset <= validSamples[trigger] && offset + n > validSamples[trigger])
+    {
+        validSamples[trigger] = offset + n;
+    }
+}
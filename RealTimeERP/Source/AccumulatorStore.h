@@ -0,0 +1,339 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef ACCUMULATOR_STORE_H_INCLUDED
+#define ACCUMULATOR_STORE_H_INCLUDED
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+/*
+* AccumulatorStore holds weighted running averages for every (trigger, channel, sample)
+* in one contiguous block of memory, replacing nested vectors of per-sample accumulators.
+*
+* Averages are stored in a single plane indexed [trigger][channel][sample]. Each channel's
+* row is padded to a whole number of cache lines and starts on a cache line boundary, so
+* per-channel loops stream over aligned, contiguous memory.
+*
+* Every sample of an epoch is added with the same weight, so instead of a count per sample
+* there is a single weight per trigger. With decay = 1 - alpha, starting an epoch does
+*
+*     weight = 1 + decay * weight,  gain = 1 / weight
+*
+* and each sample s of the epoch (which may arrive in several slices) is then added with
+*
+*     avg[s] += gain * (x[s] - avg[s])
+*
+* which is the same as keeping sum[s] = x[s] + decay * sum[s] and dividing by the weight
+* (alpha = 0 gives the linear average). Since the gain belongs to the epoch rather than to
+* the store, samples that have seen one more epoch than others are still correct averages.
+*
+* Resetting a trigger is cheap: it just sets the trigger's weight and "valid length" to 0.
+* Samples at or past the valid length read as 0, and the first epoch after a reset has gain 1,
+* so it overwrites the old data as it goes, extending the valid length.
+*
+* Optionally, the store also keeps the spread of the epochs around the average (for error
+* bands), in a second plane of the same shape: the weighted sum of squared deviations m2,
+* updated in the same pass as the average (West's weighted form of Welford's algorithm):
+*
+*     d = x[s] - avg[s],  avg[s] += gain * d,  m2[s] = decay * m2[s] + (1 - gain) * d * d
+*
+* Together with the sum of squared weights per trigger this gives the (reliability weighted,
+* unbiased) variance and the standard error of the average, for linear and exponential
+* averaging alike.
+*
+* Instead of the mean, a store with that second plane can estimate a quantile (e.g. the
+* median, which occasional artifacts barely move) by stochastic approximation, see
+* Kernels::updateQuantile. The second plane then holds the spread the steps are scaled by,
+* so memory stays at two values per sample and no epochs are kept.
+*
+* Alternatively, setWindow(N) averages only the last N epochs of each trigger (a boxcar). The
+* store then keeps the (baseline-corrected) samples of the last N epochs of each trigger in a
+* ring of N slots, and each sample of a new epoch replaces the same sample of the epoch that
+* drops out of the window, see Kernels::slideWindow:
+*
+*     avg[s] += (x[s] - oldest[s]) / N
+*
+* so adding an epoch costs the same whatever N is (while the window fills up, it is the linear
+* average). Epochs of a trigger start in order and fill at the same rate, so even when they
+* overlap, each sample of the oldest epoch is written before the newest one replaces it.
+*
+* Each trigger also has a version number that goes up whenever its data changes. Copying
+* with copyChangedFrom() only moves the triggers whose versions differ, so a copy that is
+* kept up to date (e.g. one of the AtomicallyShared slots) costs time in proportion to the
+* triggers that changed since it was last updated, not the total number of triggers.
+*/
+
+namespace RealTimeERP
+{
+    // Minimal allocator returning memory aligned to Alignment bytes (a power of 2)
+    template<typename T, size_t Alignment = 64>
+    struct AlignedAllocator
+    {
+        using value_type = T;
+
+        template<typename U>
+        struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+        AlignedAllocator() noexcept {}
+
+        template<typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+        T* allocate(size_t n)
+        {
+            // store the offset to the real allocation just before the aligned pointer
+            void* raw = std::malloc(n * sizeof(T) + Alignment + sizeof(void*));
+            if (raw == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            uintptr_t start = reinterpret_cast<uintptr_t>(raw) + sizeof(void*);
+            uintptr_t aligned = (start + Alignment - 1) & ~uintptr_t(Alignment - 1);
+            reinterpret_cast<void**>(aligned)[-1] = raw;
+            return reinterpret_cast<T*>(aligned);
+        }
+
+        void deallocate(T* p, size_t) noexcept
+        {
+            if (p != nullptr)
+            {
+                std::free(reinterpret_cast<void**>(p)[-1]);
+            }
+        }
+
+        template<typename U>
+        bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+
+        template<typename U>
+        bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+    };
+
+    template<typename T>
+    using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+    class AccumulatorStore
+    {
+    public:
+        AccumulatorStore();
+
+        /** Resizes to the given dimensions and clears all data. withVariance also keeps the
+            spread of the epochs (which doubles the memory used). */
+        void resize(int numTriggers, int numChannels, int numSamples, double alpha,
+            bool withVariance = false);
+
+        /** Copies data from another store. Does not allocate if the sizes match. The epochs of
+            a window aren't copied, so a copy can be read but not added to. */
+        AccumulatorStore& operator=(const AccumulatorStore& other);
+        AccumulatorStore(const AccumulatorStore& other) = default;
+
+        /** Copies only the triggers whose versions differ from those of the source (or
+            everything, if the dimensions differ). */
+        void copyChangedFrom(const AccumulatorStore& other);
+
+        /** Clears the data of all triggers (without touching the averages themselves) */
+        void reset();
+
+        /** Clears the data of a single trigger (without touching the averages themselves) */
+        void resetTrigger(int trigger);
+
+        int getNumTriggers() const { return numTriggers; }
+        int getNumChannels() const { return numChannels; }
+        int getNumSamples() const { return numSamples; }
+        double getAlpha() const { return alpha; }
+        bool hasVariance() const { return !m2.empty(); }
+
+        /** Estimates the given quantile (in (0, 1)) of the epochs instead of their mean, or the
+            mean again if quantile is negative. Needs the variance plane; clears all data. */
+        void setQuantile(double quantile);
+        double getQuantile() const { return quantile; }
+        bool isQuantile() const { return quantile >= 0; }
+
+        /** Averages only the last numEpochs epochs of each trigger (or all of them again, with
+            alpha's weighting, if 0). Keeps those epochs as floats, so this needs numEpochs / 2
+            times the memory of the averages; a quantile store only tracks roughly the last
+            numEpochs epochs instead and keeps none. Clears all data. */
+        void setWindow(int numEpochs);
+        int getWindow() const { return windowLength; }
+
+        /** Updates the weight of a trigger for an incoming epoch and returns the gain to add
+            its samples with. If replace is true, the epoch replaces the average instead
+            (gain 1). */
+        double beginEpoch(int trigger, bool replace = false);
+
+        /** Number of epochs begun since the trigger was last reset. Read it just before
+            beginEpoch() to get the number to add that epoch's samples with. */
+        uint64_t getNumEpochs(int trigger) const { return epochNumbers[trigger]; }
+
+        /** Adds numSamples samples (minus shift, e.g. a baseline) of one channel of an epoch,
+            starting at epoch sample offset. With a window, epoch is the epoch's number (see
+            getNumEpochs()). */
+        void addSlice(int trigger, int channel, int offset, const float* x, int numSamples,
+            double gain, double shift = 0, uint64_t epoch = 0);
+
+        /** Same as addSlice, split in two so that channels can be added in parallel: addRow()
+            only touches the channel's own row, so different channels can be added from
+            different threads. Call markAdded() once for the slice afterwards. */
+        void addRow(int trigger, int channel, int offset, const float* x, int numSamples,
+            double gain, double shift = 0, uint64_t epoch = 0);
+        void markAdded(int trigger, int offset, int numSamples);
+
+        /** Adds a single sample of an epoch */
+        void addValue(int trigger, int channel, int sample, double x, double gain, uint64_t epoch = 0);
+
+        double getWeight(int trigger) const { return weights[trigger]; }
+
+        /** Weighted variance of the epochs around the average (0 without variance or with
+            fewer than two epochs). For a quantile, estimated from the spread assuming roughly
+            normal data. */
+        double getVariance(int trigger, int channel, int sample) const
+        {
+            if (!hasVariance() || sample >= validSamples[trigger])
+            {
+                return 0.0;
+            }
+            return getVarianceOf(trigger, getM2(trigger, channel)[sample]);
+        }
+
+        /** Variance at a sample of the trigger whose second plane (see getM2) holds m2Value */
+        double getVarianceOf(int trigger, double m2Value) const
+        {
+            if (isQuantile())
+            {
+                return halfPi() * m2Value * m2Value;
+            }
+            double denominator = weights[trigger] - squaredWeights[trigger] / weights[trigger];
+            return denominator > 0 ? m2Value / denominator : 0.0;
+        }
+
+        /** Standard error of the average (its standard deviation over repeated sets of epochs).
+            For a quantile, that of the median of normal data. */
+        double getStandardError(int trigger, int channel, int sample) const
+        {
+            if (!hasVariance() || sample >= validSamples[trigger])
+            {
+                return 0.0;
+            }
+            return getStandardErrorOf(trigger, getM2(trigger, channel)[sample]);
+        }
+
+        /** Standard error at a sample of the trigger whose second plane holds m2Value. It grows
+            with m2Value, so the largest value of a range of samples gives the largest error. */
+        double getStandardErrorOf(int trigger, double m2Value) const
+        {
+            if (weights[trigger] <= 0)
+            {
+                return 0.0;
+            }
+            double variance = getVarianceOf(trigger, m2Value) * (isQuantile() ? halfPi() : 1.0);
+            return std::sqrt(variance * squaredWeights[trigger]) / weights[trigger];
+        }
+
+        /** Changes whenever the data of the trigger changes */
+        uint64_t getVersion(int trigger) const { return versions[trigger]; }
+
+        /** Changes whenever any data changes */
+        uint64_t getVersion() const { return version; }
+
+        /** Number of samples of each channel of the trigger that hold data since the last reset */
+        int getValidSamples(int trigger) const { return validSamples[trigger]; }
+
+        double getAverage(int trigger, int channel, int sample) const
+        {
+            return sample < validSamples[trigger] ? getAverages(trigger, channel)[sample] : 0.0;
+        }
+
+        /** Start of the averages of one channel of one trigger (numSamples long).
+            Only the first getValidSamples(trigger) are meaningful. */
+        double* getAverages(int trigger, int channel)
+        {
+            return averages.data() + trigger * triggerStride + channel * rowStride;
+        }
+
+        const double* getAverages(int trigger, int channel) const
+        {
+            return averages.data() + trigger * triggerStride + channel * rowStride;
+        }
+
+        /** Start of the weighted sums of squared deviations (or spreads, for a quantile) of one
+            channel of one trigger, laid out like the averages (only if hasVariance()) */
+        double* getM2(int trigger, int channel)
+        {
+            return m2.data() + trigger * triggerStride + channel * rowStride;
+        }
+
+        const double* getM2(int trigger, int channel) const
+        {
+            return m2.data() + trigger * triggerStride + channel * rowStride;
+        }
+
+    private:
+        int numTriggers;
+        int numChannels;
+        int numSamples;
+        size_t rowStride; // numSamples, rounded up to a whole cache line
+        size_t triggerStride; // numChannels * rowStride
+
+        double alpha;
+        double decay; // 1 - alpha
+        double quantile; // < 0 for the mean
+
+        int windowLength; // 0 without a window
+
+        static double halfPi() { return 1.5707963267948966; }
+
+        bool hasWindow() const { return !windowEpochs.empty(); }
+
+        // Ring slot of the epoch's samples of one channel, laid out like the averages
+        float* getWindowRow(int trigger, uint64_t epoch, int channel)
+        {
+            size_t slot = size_t(trigger) * windowLength + size_t(epoch % uint64_t(windowLength));
+            return windowEpochs.data() + slot * triggerStride + channel * rowStride;
+        }
+
+        AlignedVector<double> averages; // trigger x channel x sample (rows padded to rowStride)
+        AlignedVector<double> m2; // same layout as averages, or empty without variance (spread for a quantile)
+        std::vector<double> weights;  // trigger
+        std::vector<double> squaredWeights; // sum of the squared weights of the epochs (trigger)
+        AlignedVector<float> windowEpochs; // trigger x ring slot x channel x sample, or empty without a window
+        std::vector<uint64_t> epochNumbers; // epochs begun since the last reset (trigger)
+        std::vector<int> validSamples; // trigger
+        std::vector<uint64_t> versions; // trigger
+        uint64_t version;
+
+        // Samples [offset, offset + n) of the trigger now hold data
+        void extendValid(int trigger, int offset, int n);
+
+        void markChanged(int trigger)
+        {
+            ++versions[trigger];
+            ++version;
+        }
+    };
+}
+
+#endif // ACCUMULATOR_STORE_H_INCLUDED
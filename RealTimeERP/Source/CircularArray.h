@@ -25,11 +25,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define CIRCULAR_ARRAY_H_INCLUDED
 
 /*
-Extends (by ownership) the JUCE array type to use circular (modular) indices.
-@see Array
+Extends (by ownership) a std::vector to use circular (modular) indices.
+Doesn't depend on JUCE, so it can also be used outside the plugin (e.g. in benchmarks).
 */
 
-#include <BasicJuceHeader.h>
+#include <algorithm>
+#include <cassert>
+#include <vector>
 
 template <typename ElementType>
 class CircularArray
@@ -43,7 +45,7 @@ public:
     */
     CircularArray(int length) : start(0), isReset(true)
     {
-        array.resize(jmax(0, length));
+        array.resize(std::max(0, length));
     }
 
     ~CircularArray() {}
@@ -51,9 +53,7 @@ public:
     /** Resets each element of the array to default value (without changing the size) */
     void reset()
     {
-        int length = size();
-        array.clearQuick();
-        array.insertMultiple(0, ElementType(), length);
+        std::fill(array.begin(), array.end(), ElementType());
         start = 0;
         isReset = true;
     }
@@ -69,7 +69,7 @@ public:
     /** Returns number of elements in the array. */
     int size() const
     {
-        return array.size();
+        return int(array.size());
     }
 
     /** Changes the size of the array by adding empty elements to or removing from the end
@@ -77,7 +77,7 @@ public:
     */
     void resize(const int targetNumItems)
     {
-        jassert(targetNumItems >= 0);
+        assert(targetNumItems >= 0);
         int length = size();
         if (targetNumItems == 0)
         {
@@ -112,7 +112,7 @@ public:
     {
         if (size() > 0)
         {
-            array.set(circToLinInd(indexToChange), newValue);
+            array[circToLinInd(indexToChange)] = newValue;
             if (newValue != ElementType())
             {
                 isReset = false;
@@ -120,6 +120,17 @@ public:
         }
     }
 
+    /** Subtracts a value from every element (without changing their order)
+        @param value    value to subtract
+    */
+    void subtractFromAll(ElementType value)
+    {
+        for (ElementType& element : array)
+        {
+            element -= value;
+        }
+    }
+
     /** Adds a new element at the end of the array, overwriting the previous first element.
         Does not change the array size and does nothing if the array is empty.
         @param newElement      new element to enqueue
@@ -139,23 +150,46 @@ public:
     void enqueueArray(const ElementType* newValues, int numberOfElements)
     {
         int length = size();
-        int n = jmin(numberOfElements, length);
+        if (length == 0)
+        {
+            return;
+        }
+
+        int n = std::min(numberOfElements, length);
         int nToSkip = numberOfElements - n;
-        int nFirstSegment = jmin(n, length - start);
+        int nFirstSegment = std::min(n, length - start);
         int nSecondSegment = n - nFirstSegment;
 
-        for (int i = 0; i < nFirstSegment; ++i)
-        {
-            array.set(start + i, newValues[nToSkip + i]);
-        }
+        ElementType* data = array.data();
+        std::copy(newValues + nToSkip, newValues + nToSkip + nFirstSegment, data + start);
+        std::copy(newValues + nToSkip + nFirstSegment, newValues + nToSkip + nFirstSegment + nSecondSegment, data);
+
+        start = mod(start + n, length);
+        isReset = false;
+    }
 
-        for (int i = 0; i < nSecondSegment; ++i)
+    /** Gets read access to the elements [index, index + numberOfElements) without copying them.
+        Because the array is circular, they may be split into two contiguous runs: the first
+        starts at firstRun, and the rest (if any) start at secondRun.
+        @param index                circular index of the first element
+        @param numberOfElements     number of elements to access (at most size())
+        @return                     number of elements in the first run
+    */
+    int getSpans(int index, int numberOfElements, const ElementType*& firstRun,
+        const ElementType*& secondRun) const
+    {
+        int length = size();
+        assert(numberOfElements <= length);
+
+        firstRun = secondRun = array.data();
+        if (length == 0 || numberOfElements <= 0)
         {
-            array.set(i, newValues[nToSkip + nFirstSegment + i]);
+            return 0;
         }
 
-        start = mod(start + n, length);
-        isReset = false;
+        int linStart = circToLinInd(index);
+        firstRun += linStart;
+        return std::min(numberOfElements, length - linStart);
     }
 
     /** Inserts multiple copies of an element into the array at a given position (lengthening
@@ -193,7 +227,7 @@ public:
                 linIndexToInsertAt = 0;
             }
 
-            array.insertMultiple(linIndexToInsertAt, newElement, numberOfTimesToInsertIt);
+            array.insert(array.begin() + linIndexToInsertAt, numberOfTimesToInsertIt, newElement);
 
             // move start to follow first element if it was moved and we're not inserting at 0
             if (linIndexToInsertAt <= start && indexToInsertAt > 0)
@@ -233,17 +267,17 @@ public:
             if (isReset)
             {
                 start = 0;
-                array.removeLast(howManyToRemove);
+                array.resize(length - howManyToRemove);
                 return;
             }
 
             // howManyToRemove < length and we can't move start.
 
-            int numRemoveFromStart = jmin(start, howManyToRemove);
+            int numRemoveFromStart = std::min(start, howManyToRemove);
             int numRemoveFromEnd = howManyToRemove - numRemoveFromStart;
 
-            array.removeLast(numRemoveFromEnd);
-            array.removeRange(start - numRemoveFromStart, numRemoveFromStart);
+            array.resize(length - numRemoveFromEnd);
+            array.erase(array.begin() + (start - numRemoveFromStart), array.begin() + start);
             start -= numRemoveFromStart;
         }
     }
@@ -257,11 +291,11 @@ private:
 
     static int mod(int x, int m)
     {
-        jassert(m > 0);
+        assert(m > 0);
         return (x % m + m) % m;
     }
 
-    Array<ElementType> array;
+    std::vector<ElementType> array;
     int start; // index of the start of the array
     bool isReset; // whether all elements are default
 };
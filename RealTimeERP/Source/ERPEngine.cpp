@@ -0,0 +1,660 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ERPEngine.h"
+#include "SimdKernels.h"
+
+#include <algorithm>
+#include <limits>
+#include <new>
+
+using namespace RealTimeERP;
+
+// Fewest channels per worker pool thread (below twice this, everything runs on the calling thread)
+static const int minChannelsPerThread = 32;
+
+// The channels are split into up to this many tasks per thread (of at least minChannelsPerTask),
+// so that a worker that gets descheduled in the middle of a block holds up less of it; the
+// calling thread takes the tasks it doesn't get to
+static const int tasksPerThread = 4;
+static const int minChannelsPerTask = 8;
+
+// Most memory for the epochs kept by a "last N" window (longer windows are shortened to fit)
+static const size_t maxWindowBytes = size_t(1) << 30;
+
+// Archived epochs replayed per pass over the channels
+static const int replayBatchSize = 64;
+
+ERPEngine::ERPEngine()
+    : numChannels       (0)
+    , preSamples        (0)
+    , replace           (false)
+    , blockChannels     (nullptr)
+    , blockSize         (0)
+    , blockTimestamp    (0)
+    , historyEnd        (0)
+    , historyCount      (0)
+    , historySinceRebase(0)
+    , rebaseSums        (false)
+    , channelsPerTask   (0)
+    , timings           (nullptr)
+    , archive           (nullptr)
+    , replayArchive     (nullptr)
+    , replayChannelMap  (nullptr)
+    , replayOffset      (0)
+    , replayFirst       (0)
+{}
+
+ERPEngine::~ERPEngine() {}
+
+void ERPEngine::configure(int numTriggers, int nChannels, int epochSamples, int nPreSamples,
+    int latencySamples, double alpha, double quantile, int window)
+{
+    discardArchiveBuffers();
+
+    numChannels = std::max(0, nChannels);
+    preSamples = std::max(0, std::min(nPreSamples, epochSamples));
+
+    // No open epochs
+    scheduler.resize(numTriggers, epochSamples);
+
+    // One epoch state per scheduler slot, allocated up front so processBlock() never allocates
+    openEpochs.assign(numTriggers, vector<EpochState>(scheduler.getNumSlots(), makeEpochState()));
+    blockSlices.reserve(numTriggers * scheduler.getNumSlots());
+
+    // Without a pre-trigger window, epochs never need samples from before the current block
+    // (and with one, at most a late trigger's pre-trigger window of them, whatever the block size)
+    int historyLength = preSamples > 0
+        ? preSamples + std::max(0, latencySamples) + 1
+        : 0;
+    history.assign(historyLength > 0 ? numChannels : 0, CircularArray<float>(historyLength));
+    historySums.assign(history.size(), CircularArray<double>(historyLength));
+    runningSums.assign(history.size(), 0.0);
+    historyCount = 0;
+    historySinceRebase = 0;
+
+    // A window keeps its last epochs of every trigger and channel, which can take a lot of
+    // memory; if even a shortened one can't be allocated, average without it
+    window = std::min(window, getMaxWindow(numTriggers, numChannels, epochSamples, quantile));
+    try
+    {
+        averages.resize(numTriggers, numChannels, epochSamples, alpha, quantile, window);
+    }
+    catch (const std::bad_alloc&)
+    {
+        averages.resize(numTriggers, numChannels, epochSamples, alpha, quantile, 0);
+    }
+
+    // Dimensions may no longer match
+    setArchive(archive);
+
+    if (workerPool != nullptr)
+    {
+        startWorkers(); // for the new channel count
+    }
+}
+
+void ERPEngine::startWorkers()
+{
+    workerPool.reset();
+
+    // Spread the per-channel work of high channel count probes over a few threads
+    int numWorkers = WorkerPool::getDefaultNumWorkers();
+    if (numChannels >= 2 * minChannelsPerThread && numWorkers > 0)
+    {
+        int numThreads = std::min(numWorkers + 1, numChannels / minChannelsPerThread);
+        int numTasks = std::min(numThreads * tasksPerThread, numChannels / minChannelsPerTask);
+        channelsPerTask = (numChannels + numTasks - 1) / numTasks;
+        workerPool.reset(new WorkerPool(numThreads - 1));
+    }
+}
+
+void ERPEngine::stopWorkers()
+{
+    workerPool.reset();
+}
+
+int ERPEngine::getMaxWindow(int numTriggers, int numChannels, int epochSamples, double quantile)
+{
+    // (a quantile doesn't keep the waveforms, and the statistics take next to nothing)
+    if (quantile >= 0)
+    {
+        return std::numeric_limits<int>::max();
+    }
+    size_t bytesPerEpoch = size_t(std::max(1, numTriggers)) * std::max(1, numChannels) * std::max(1, epochSamples) * sizeof(float);
+    return int(std::min<size_t>(std::numeric_limits<int>::max(), maxWindowBytes / bytesPerEpoch));
+}
+
+int ERPEngine::getNumWorkers() const
+{
+    return workerPool != nullptr ? workerPool->getNumWorkers() : 0;
+}
+
+bool ERPEngine::addEvent(int trigger, int64_t timestamp)
+{
+    return scheduler.addEvent(trigger, timestamp - preSamples);
+}
+
+ERPEngine::EpochState ERPEngine::makeEpochState() const
+{
+    EpochState state;
+    state.gain = 0;
+    state.number = 0;
+    state.absSum.resize(numChannels);
+    state.peak.resize(numChannels);
+    state.timeToPeak.resize(numChannels);
+    state.baseline.resize(numChannels);
+    state.archiveBuffer = -1;
+    state.archiveData = nullptr;
+    state.startTimestamp = 0;
+    return state;
+}
+
+bool ERPEngine::setArchive(EpochArchive* epochArchive)
+{
+    discardArchiveBuffers();
+
+    bool matches = epochArchive == nullptr || (epochArchive->isOpen()
+        && epochArchive->getNumChannels() == numChannels
+        && epochArchive->getEpochSamples() == scheduler.getEpochLength());
+    archive = matches ? epochArchive : nullptr;
+    return matches;
+}
+
+void ERPEngine::discardArchiveBuffers(int trigger)
+{
+    if (archive == nullptr)
+    {
+        return;
+    }
+
+    for (int t = 0; t < int(openEpochs.size()); ++t)
+    {
+        if (trigger >= 0 && t != trigger)
+        {
+            continue;
+        }
+        for (EpochState& epoch : openEpochs[t])
+        {
+            if (epoch.archiveBuffer >= 0)
+            {
+                archive->discardBuffer(epoch.archiveBuffer);
+                epoch.archiveBuffer = -1;
+                epoch.archiveData = nullptr;
+            }
+        }
+    }
+}
+
+int ERPEngine::getNumOpenEpochs() const
+{
+    int numOpen = 0;
+    for (int t = 0; t < scheduler.getNumTriggers(); ++t)
+    {
+        numOpen += scheduler.getNumOpenEpochs(t);
+    }
+    return numOpen;
+}
+
+void ERPEngine::reset()
+{
+    // Open epochs were weighted for the old averages, so drop them too
+    discardArchiveBuffers();
+    scheduler.reset();
+    averages.reset();
+}
+
+void ERPEngine::clearOpenEpochs()
+{
+    discardArchiveBuffers();
+    scheduler.reset();
+    historyCount = 0;
+}
+
+void ERPEngine::resetTrigger(int trigger)
+{
+    if (trigger >= 0 && trigger < scheduler.getNumTriggers())
+    {
+        // Cheap: marks the trigger empty instead of zeroing its averages
+        discardArchiveBuffers(trigger);
+        scheduler.resetTrigger(trigger);
+        averages.resetTrigger(trigger);
+    }
+}
+
+void ERPEngine::setReplace(bool shouldReplace)
+{
+    if (shouldReplace != replace)
+    {
+        replace = shouldReplace;
+        reset();
+    }
+}
+
+void ERPEngine::updateEnvelope()
+{
+    averages.envelope.updateDirty();
+}
+
+int ERPEngine::processBlock(const float* const* channels, int numSamples, int64_t timestamp)
+{
+    if (numChannels <= 0 || numSamples <= 0)
+    {
+        discardArchiveBuffers();
+        scheduler.reset();
+        return 0;
+    }
+
+    int64_t startTime = timings != nullptr ? ProcessTimings::now() : 0;
+
+    // Epochs can reach back into the history, which holds the samples before this block
+    // (this block is added once it has been folded). After a gap in the timestamps it starts over.
+    int64_t earliestTimestamp = timestamp;
+    if (!history.empty())
+    {
+        historyCount = timestamp == historyEnd ? historyCount : 0;
+        earliestTimestamp = timestamp - historyCount;
+
+        // Once the history has wrapped, the sums restart from its oldest sample
+        historySinceRebase += numSamples;
+        rebaseSums = historySinceRebase >= history[0].size();
+        historySinceRebase = rebaseSums ? 0 : historySinceRebase;
+    }
+
+    // Fold this block into every open epoch (there can be several per trigger)
+    blockTimestamp = timestamp;
+    blockSlices.clear();
+    scheduler.forEachSlice(timestamp, numSamples, earliestTimestamp, [this](const EpochScheduler::Slice& slice)
+    {
+        beginSlice(slice);
+        blockSlices.push_back(slice);
+    });
+
+    if (blockSlices.empty() && history.empty())
+    {
+        if (timings != nullptr)
+        {
+            timings->addTimeSince(ProcessTimings::EPOCH_FOLD, startTime);
+        }
+        return 0;
+    }
+
+    blockChannels = channels;
+    blockSize = numSamples;
+    if (workerPool != nullptr)
+    {
+        // the block is shared with the workers, which are done when run() returns
+        workerPool->run((numChannels + channelsPerTask - 1) / channelsPerTask, foldChannelTask, this);
+    }
+    else
+    {
+        foldChannels(0, numChannels);
+    }
+    blockChannels = nullptr;
+
+    if (!history.empty())
+    {
+        historyCount = std::min(historyCount + numSamples, history[0].size());
+        historyEnd = timestamp + numSamples;
+    }
+
+    if (timings != nullptr)
+    {
+        startTime = timings->addTimeSince(ProcessTimings::EPOCH_FOLD, startTime);
+    }
+
+    int numCompleted = 0;
+    for (const EpochScheduler::Slice& slice : blockSlices)
+    {
+        finishSlice(slice);
+        numCompleted += slice.completesEpoch ? 1 : 0;
+    }
+
+    // The averages get published when epochs complete, so the whole envelope has to be current then
+    if (numCompleted > 0)
+    {
+        averages.envelope.updateDirty();
+    }
+
+    if (timings != nullptr)
+    {
+        timings->addTimeSince(ProcessTimings::STATISTICS, startTime);
+    }
+    return numCompleted;
+}
+
+void ERPEngine::beginSlice(const EpochScheduler::Slice& slice)
+{
+    if (slice.startsEpoch)
+    {
+        EpochState& epoch = openEpochs[slice.trigger][slice.slot];
+
+        // In instantaneous mode each epoch replaces the average
+        epoch.number = averages.lfp.getNumEpochs(slice.trigger);
+        epoch.gain = averages.lfp.beginEpoch(slice.trigger, replace);
+        std::fill(epoch.absSum.begin(), epoch.absSum.end(), 0.0);
+        std::fill(epoch.peak.begin(), epoch.peak.end(), 0.0f);
+        std::fill(epoch.timeToPeak.begin(), epoch.timeToPeak.end(), 0);
+        std::fill(epoch.baseline.begin(), epoch.baseline.end(), 0.0);
+
+        // Keep the raw samples too, if there's a free archive buffer
+        if (archive != nullptr)
+        {
+            epoch.archiveBuffer = archive->acquireBuffer();
+            epoch.archiveData = epoch.archiveBuffer >= 0 ? archive->getBuffer(epoch.archiveBuffer) : nullptr;
+            epoch.startTimestamp = blockTimestamp + slice.bufferStart;
+        }
+    }
+}
+
+void ERPEngine::foldChannels(int firstChannel, int lastChannel)
+{
+    // Each channel only touches its own row of the averages and its own statistics,
+    // so separate channel ranges can run in parallel
+    for (const EpochScheduler::Slice& slice : blockSlices)
+    {
+        int t = slice.trigger;
+        int offset = int(slice.epochOffset);
+        EpochState& epoch = openEpochs[t][slice.slot];
+
+        // Part of the slice from before this block, if any
+        int numPast = std::min(slice.numSamples, std::max(0, -slice.bufferStart));
+        int historyIndex = history.empty() ? 0 : history[0].size() + slice.bufferStart;
+
+        for (int n = firstChannel; n < lastChannel; n++)
+        {
+            if (slice.startsEpoch && preSamples > 0)
+            {
+                // The pre-trigger window is in the history and this block by the time the epoch starts
+                int64_t start = std::max(blockTimestamp + slice.bufferStart, blockTimestamp - historyCount);
+                int64_t end = std::min(blockTimestamp + slice.bufferStart + preSamples, blockTimestamp + blockSize);
+                epoch.baseline[n] = end > start ? getSum(n, start, end) / double(end - start) : 0.0;
+            }
+
+            if (numPast > 0)
+            {
+                const float* firstRun;
+                const float* secondRun;
+                int numFirst = history[n].getSpans(historyIndex, numPast, firstRun, secondRun);
+                foldSamples(t, n, epoch, offset, firstRun, numFirst);
+                foldSamples(t, n, epoch, offset + numFirst, secondRun, numPast - numFirst);
+            }
+
+            if (numPast < slice.numSamples)
+            {
+                const float* rpIn = blockChannels[n] + slice.bufferStart + numPast;
+                foldSamples(t, n, epoch, offset + numPast, rpIn, slice.numSamples - numPast);
+            }
+
+            // (while the new averages are still in the cache)
+            averages.envelope.updateBase(averages.lfp, t, n, offset, slice.numSamples);
+        }
+    }
+
+    // Only once the block's epochs have read the samples before it
+    if (!history.empty())
+    {
+        for (int n = firstChannel; n < lastChannel; n++)
+        {
+            appendHistory(n);
+        }
+    }
+}
+
+void ERPEngine::foldSamples(int t, int n, EpochState& epoch, int offset, const float* x, int count)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    averages.lfp.addRow(t, n, offset, x, count, epoch.gain, epoch.baseline[n], epoch.number);
+
+    if (epoch.archiveData != nullptr)
+    {
+        std::copy(x, x + count, epoch.archiveData + size_t(n) * scheduler.getEpochLength() + offset);
+    }
+
+    // The statistics only cover the part after the trigger
+    int skip = std::max(0, preSamples - offset);
+    if (skip < count)
+    {
+        Kernels::absSumAndPeak(x + skip, count - skip, offset + skip - preSamples,
+            epoch.absSum[n], epoch.peak[n], epoch.timeToPeak[n], float(epoch.baseline[n]));
+    }
+}
+
+void ERPEngine::appendHistory(int n)
+{
+    const float* rpIn = blockChannels[n];
+    history[n].enqueueArray(rpIn, blockSize);
+
+    // Only the samples that fit in the history need their sums stored
+    int historyLength = historySums[n].size();
+    int first = std::max(0, blockSize - historyLength);
+    double sum = runningSums[n];
+    for (int i = 0; i < first; i++)
+    {
+        sum += rpIn[i];
+    }
+
+    double sums[256];
+    for (int i = first; i < blockSize; i += 256)
+    {
+        int count = std::min(256, blockSize - i);
+        for (int j = 0; j < count; j++)
+        {
+            sums[j] = sum;
+            sum += rpIn[i + j];
+        }
+        historySums[n].enqueueArray(sums, count);
+    }
+
+    // Keep the sums as small as the history (so they don't lose precision as they grow),
+    // once per pass over it
+    if (rebaseSums)
+    {
+        double base = historySums[n][0];
+        historySums[n].subtractFromAll(base);
+        sum -= base;
+    }
+    runningSums[n] = sum;
+}
+
+double ERPEngine::getSum(int n, int64_t start, int64_t end) const
+{
+    // The part before this block from the history's sums, the rest from the block itself
+    int64_t split = std::min(end, blockTimestamp);
+    double sum = split > start ? getSumBefore(n, split) - getSumBefore(n, start) : 0.0;
+    for (int64_t i = std::max(start, blockTimestamp); i < end; i++)
+    {
+        sum += blockChannels[n][i - blockTimestamp];
+    }
+    return sum;
+}
+
+double ERPEngine::getSumBefore(int n, int64_t timestamp) const
+{
+    if (timestamp >= historyEnd)
+    {
+        return runningSums[n];
+    }
+    return historySums[n][int(historySums[n].size() - (historyEnd - timestamp))];
+}
+
+void ERPEngine::foldChannelTask(void* engine, int task)
+{
+    ERPEngine* self = static_cast<ERPEngine*>(engine);
+    int first = task * self->channelsPerTask;
+    self->foldChannels(first, std::min(first + self->channelsPerTask, self->numChannels));
+}
+
+void ERPEngine::finishSlice(const EpochScheduler::Slice& slice)
+{
+    int t = slice.trigger;
+    averages.lfp.markAdded(t, int(slice.epochOffset), slice.numSamples);
+    averages.envelope.markDirty(t, int(slice.epochOffset), slice.numSamples);
+
+    // Epoch done, update values
+    if (slice.completesEpoch)
+    {
+        finishEpoch(t, openEpochs[t][slice.slot]);
+    }
+}
+
+void ERPEngine::finishEpoch(int t, EpochState& epoch)
+{
+    uint64_t number = averages.stats.getNumEpochs(t);
+    double gain = averages.stats.beginEpoch(t, replace);
+
+    for (int n = 0; n < numChannels; n++)
+    {
+        averages.stats.addValue(t, n, ERPSnapshot::AREA_UNDER_CURVE, epoch.absSum[n], gain, number);
+        averages.stats.addValue(t, n, ERPSnapshot::PEAK_HEIGHT, epoch.peak[n], gain, number);
+        averages.stats.addValue(t, n, ERPSnapshot::TIME_TO_PEAK, epoch.timeToPeak[n], gain, number);
+    }
+
+    averages.epochCount[t]++;
+    averages.totalEpochs++;
+
+    if (epoch.archiveBuffer >= 0)
+    {
+        archive->commitBuffer(epoch.archiveBuffer, t, epoch.startTimestamp);
+        epoch.archiveBuffer = -1;
+        epoch.archiveData = nullptr;
+    }
+}
+
+bool ERPEngine::replay(const EpochArchiveReader& reader, const vector<int>& channelMap)
+{
+    int epochLength = int(scheduler.getEpochLength());
+    int offset = reader.getPreSamples() - preSamples;
+    if (!reader.isOpen() || int(channelMap.size()) != numChannels || offset < 0
+        || offset + epochLength > reader.getEpochSamples())
+    {
+        return false;
+    }
+
+    reset();
+
+    replayArchive = &reader;
+    replayChannelMap = &channelMap;
+    replayOffset = offset;
+    replayEpochs.assign(replayBatchSize, makeEpochState());
+    replayTriggers.assign(replayBatchSize, -1);
+    replayZeros.assign(epochLength, 0.0f);
+
+    uint64_t numRecords = reader.getNumRecords();
+    for (replayFirst = 0; replayFirst < numRecords; replayFirst += replayBatchSize)
+    {
+        int batchSize = int(std::min<uint64_t>(replayBatchSize, numRecords - replayFirst));
+
+        // Weights only depend on the order of the epochs, so all the gains of the batch are
+        // known before any samples are added
+        for (int i = 0; i < replayBatchSize; ++i)
+        {
+            int t = i < batchSize ? reader.getRecord(replayFirst + i).trigger : -1;
+            replayTriggers[i] = t >= 0 && t < getNumTriggers() ? t : -1;
+            if (replayTriggers[i] >= 0)
+            {
+                replayEpochs[i].number = averages.lfp.getNumEpochs(t);
+                replayEpochs[i].gain = averages.lfp.beginEpoch(t, replace);
+            }
+        }
+
+        // Each channel only touches its own rows, as in processBlock()
+        if (workerPool != nullptr)
+        {
+            workerPool->run((numChannels + channelsPerTask - 1) / channelsPerTask, replayChannelTask, this);
+        }
+        else
+        {
+            replayChannels(0, numChannels);
+        }
+
+        for (int i = 0; i < batchSize; ++i)
+        {
+            int t = replayTriggers[i];
+            if (t >= 0)
+            {
+                averages.lfp.markAdded(t, 0, epochLength);
+                finishEpoch(t, replayEpochs[i]);
+            }
+        }
+    }
+
+    // (once at the end rather than after every epoch)
+    for (int t = 0; t < getNumTriggers(); ++t)
+    {
+        averages.envelope.updateTrigger(averages.lfp, t);
+    }
+
+    replayArchive = nullptr;
+    replayChannelMap = nullptr;
+    replayEpochs.clear();
+    replayTriggers.clear();
+    replayZeros.clear();
+    return true;
+}
+
+void ERPEngine::replayChannels(int firstChannel, int lastChannel)
+{
+    int epochLength = int(replayZeros.size());
+
+    for (int i = 0; i < replayBatchSize; ++i)
+    {
+        int t = replayTriggers[i];
+        if (t < 0)
+        {
+            continue;
+        }
+
+        EpochState& epoch = replayEpochs[i];
+        for (int n = firstChannel; n < lastChannel; n++)
+        {
+            int archived = (*replayChannelMap)[n];
+            const float* x = archived >= 0
+                ? replayArchive->getSamples(replayFirst + i, archived) + replayOffset
+                : replayZeros.data();
+
+            double baseline = 0;
+            for (int s = 0; s < preSamples; s++)
+            {
+                baseline += x[s];
+            }
+            epoch.baseline[n] = preSamples > 0 ? baseline / preSamples : 0.0;
+            epoch.absSum[n] = 0;
+            epoch.peak[n] = 0;
+            epoch.timeToPeak[n] = 0;
+
+            foldSamples(t, n, epoch, 0, x, epochLength);
+        }
+    }
+}
+
+void ERPEngine::replayChannelTask(void* engine, int task)
+{
+    ERPEngine* self = static_cast<ERPEngine*>(engine);
+    int first = task * self->channelsPerTask;
+    self->replayChannels(first, std::min(first + self->channelsPerTask, self->numChannels));
+}
@@ -0,0 +1,245 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef ERP_ENGINE_H_INCLUDED
+#define ERP_ENGINE_H_INCLUDED
+
+#include "CircularArray.h"
+#include "EpochArchive.h"
+#include "EpochScheduler.h"
+#include "ERPSnapshot.h"
+#include "ProcessTimings.h"
+#include "WorkerPool.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+* ERPEngine does the epoching and statistics for the plugin: given TTL timestamps and blocks
+* of continuous data, it keeps the running averages of the waveform, area under curve, peak
+* height and time to peak for each trigger and channel (see ERPSnapshot).
+*
+* It only depends on the standard library, so it can be driven without the GUI (e.g. by the
+* benchmark in ../Benchmark). Node owns one and feeds it from process().
+*
+* Each block is folded into the averages in three steps: beginSlice() for each slice of an
+* open epoch, then foldChannels() for all channels (split between the worker pool and the
+* calling thread, if there is a pool), then finishSlice() per slice. foldChannels() also
+* updates the finest level of the waveform's envelope pyramid, and the coarser levels are
+* brought up to date whenever epochs complete (that's when the averages get published).
+*
+* With an EpochArchive attached, the raw samples of each epoch are also copied into an archive
+* buffer as they are folded in, and the buffer is handed to the archive's writer thread once
+* the epoch completes. replay() goes the other way: it recomputes the averages from the epochs
+* in an archive, with this engine's settings, splitting the channels over the worker pool.
+*
+* configure(), replay() and startWorkers()/stopWorkers() allocate; everything else is
+* real-time safe.
+*/
+
+namespace RealTimeERP
+{
+    class ERPEngine
+    {
+        template<typename T>
+        using vector = std::vector<T>;
+
+    public:
+        ERPEngine();
+        ~ERPEngine();
+
+        /** Sets the dimensions and drops all data and open epochs.
+            @param epochSamples     whole epoch length, including the pre-trigger window
+            @param preSamples       pre-trigger window, used as the baseline (0 for none)
+            @param latencySamples   latest a TTL can arrive after its timestamp and still get
+                                    its whole pre-trigger window
+            @param alpha            decay of the running averages (0 for linear)
+            @param quantile         if in (0, 1), estimate that quantile of the waveforms (e.g.
+                                    0.5 for the median) instead of their mean
+            @param window           if > 0, only average the last window epochs of each trigger
+                                    (instead of weighting them with alpha). Shortened to
+                                    getMaxWindow(), or turned off if it can't be allocated;
+                                    getWindow() has the one in use.
+        */
+        void configure(int numTriggers, int numChannels, int epochSamples, int preSamples,
+            int latencySamples, double alpha, double quantile = -1, int window = 0);
+
+        /** Window currently in use (0 for none) */
+        int getWindow() const { return averages.lfp.getWindow(); }
+
+        /** Longest window whose epochs fit in the memory set aside for them */
+        static int getMaxWindow(int numTriggers, int numChannels, int epochSamples, double quantile = -1);
+
+        /** Starts a worker pool if there are enough channels for it to be worth it */
+        void startWorkers();
+        void stopWorkers();
+        int getNumWorkers() const;
+
+        /** Opens an epoch for the trigger; the trigger is at the timestamp, so the epoch starts
+            preSamples before it. Returns false if the event had to be dropped. */
+        bool addEvent(int trigger, int64_t timestamp);
+
+        /** Folds a block of numSamples samples starting at timestamp into every open epoch.
+            channels[n] is the block of channel n (one for each of numChannels).
+            Returns the number of epochs that completed. */
+        int processBlock(const float* const* channels, int numSamples, int64_t timestamp);
+
+        /** Clears everything (or one trigger), including open epochs */
+        void reset();
+        void resetTrigger(int trigger);
+
+        /** Drops the open epochs and the history of samples but keeps the averages, e.g. when
+            acquisition restarts (and the timestamps may start over, which would leave epochs
+            waiting for samples that never come) */
+        void clearOpenEpochs();
+
+        /** If true, each epoch replaces the averages instead of being averaged in. Switching
+            starts the averages over (a window can't carry on from replaced averages). */
+        void setReplace(bool shouldReplace);
+        bool getReplace() const { return replace; }
+
+        const ERPSnapshot& getAverages() const { return averages; }
+
+        /** Brings the envelope up to date with every sample folded so far (processBlock() only
+            does when epochs complete), e.g. before publishing the averages after a command */
+        void updateEnvelope();
+
+        /** If not null, processBlock() adds the time it spends folding samples into epochs
+            and on statistics to these */
+        void setTimings(ProcessTimings* processTimings) { timings = processTimings; }
+
+        /** Archives every epoch that starts from now on to the archive (or stops archiving, if
+            null), which must be open with this engine's channel count and epoch length.
+            Returns false (and stops archiving) if it isn't. Call between blocks. */
+        bool setArchive(EpochArchive* epochArchive);
+
+        /** Replaces the averages with those of the epochs in an archive, as if they had just
+            been recorded with the current settings (alpha, quantile, replace, window).
+            channelMap[n] is the archived channel to use for channel n, or -1 for none (which
+            then averages zeros); archived triggers are used by index. The archive's epochs are
+            cut down to this engine's pre-trigger window and epoch length, so these must fit.
+            Returns false (leaving the averages alone) if they don't. Not for the audio thread. */
+        bool replay(const EpochArchiveReader& archive, const vector<int>& channelMap);
+
+        int getNumTriggers() const { return scheduler.getNumTriggers(); }
+        int getNumChannels() const { return numChannels; }
+
+        /** Open epochs of all triggers */
+        int getNumOpenEpochs() const;
+
+        /** Most epochs of all triggers that can be open at once (more events are dropped) */
+        int getMaxOpenEpochs() const { return scheduler.getNumTriggers() * scheduler.getNumSlots(); }
+
+        uint64_t getNumDroppedEvents(int trigger) const { return scheduler.getNumDroppedEvents(trigger); }
+
+    private:
+        // Running statistics of an epoch that is still being filled
+        struct EpochState
+        {
+            double gain; // weight of this epoch's samples in the average waveform
+            uint64_t number; // of the epoch in its trigger's average waveform (for a window)
+            vector<double> absSum; // area under curve so far (channel)
+            vector<float> peak; // peak height so far (channel)
+            vector<int> timeToPeak; // sample of the peak, after the trigger (channel)
+            vector<double> baseline; // mean of the pre-trigger window (channel)
+            int archiveBuffer; // archive buffer holding its samples, or -1 if not archived
+            float* archiveData; // samples of that buffer (channel x sample)
+            int64_t startTimestamp; // of the first sample
+        };
+
+        // Empty state for the current channel count
+        EpochState makeEpochState() const;
+
+        void beginSlice(const EpochScheduler::Slice& slice);
+        void foldChannels(int firstChannel, int lastChannel); // [first, last)
+        void finishSlice(const EpochScheduler::Slice& slice);
+        static void foldChannelTask(void* engine, int task);
+
+        // Adds the statistics of a completed epoch
+        void finishEpoch(int trigger, EpochState& epoch);
+
+        // Folds the current replay batch into the averages, for channels [first, last)
+        void replayChannels(int firstChannel, int lastChannel);
+        static void replayChannelTask(void* engine, int task);
+
+        // Adds count consecutive samples of one channel of an epoch, starting at epoch sample offset
+        void foldSamples(int trigger, int channel, EpochState& epoch, int offset, const float* x, int count);
+
+        // Gives the archive buffers of the open epochs of a trigger (or all, if trigger < 0) back
+        void discardArchiveBuffers(int trigger = -1);
+
+        // Adds the current block of one channel to its history
+        void appendHistory(int channel);
+
+        // Sum of the samples of a channel in [start, end), which must be in the history or the
+        // current block (while it is being folded)
+        double getSum(int channel, int64_t start, int64_t end) const;
+
+        // Sum of the samples of a channel from the oldest one in the history when the sums were
+        // last rebased up to (not including) the timestamp, which must be in the history or
+        // equal to historyEnd (only differences between them mean anything)
+        double getSumBefore(int channel, int64_t timestamp) const;
+
+        int numChannels;
+        int preSamples;
+        bool replace;
+
+        EpochScheduler scheduler; // open epochs for each trigger
+        vector<vector<EpochState>> openEpochs; // state of each open epoch (trigger x scheduler slot)
+        ERPSnapshot averages;
+
+        vector<EpochScheduler::Slice> blockSlices; // slices of the current block (reserved up front)
+        const float* const* blockChannels; // current block, only valid during processBlock()
+        int blockSize;
+        int64_t blockTimestamp;
+
+        // Recent samples of each channel from before the current block, so that epochs can
+        // reach back before the block their trigger arrives in (empty without a pre-trigger
+        // window). Alongside, the sum of all samples before each one, for O(1) baselines.
+        vector<CircularArray<float>> history; // channel x sample
+        vector<CircularArray<double>> historySums; // channel x sample
+        vector<double> runningSums; // sum of the samples so far (channel)
+        int64_t historyEnd; // timestamp just after the newest sample in the history
+        int historyCount; // number of samples in the history that hold data
+        int historySinceRebase; // samples added since the sums were last rebased
+        bool rebaseSums; // whether the current block rebases the sums
+
+        std::unique_ptr<WorkerPool> workerPool; // null if there are too few channels to be worth it
+        int channelsPerTask;
+
+        ProcessTimings* timings;
+        EpochArchive* archive; // null if not archiving
+
+        // Batch of archived epochs being replayed, only valid during replay()
+        const EpochArchiveReader* replayArchive;
+        const vector<int>* replayChannelMap;
+        int replayOffset; // first archived sample of each epoch that is used
+        uint64_t replayFirst; // record of the first epoch of the batch
+        vector<EpochState> replayEpochs; // batch
+        vector<int> replayTriggers; // batch (-1 to skip the epoch)
+        vector<float> replayZeros; // samples of channels that aren't in the archive
+    };
+}
+
+#endif // ERP_ENGINE_H_INCLUDED
@@ -0,0 +1,73 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ERPSnapshot.h"
+
+#include <algorithm>
+
+using namespace RealTimeERP;
+
+ERPSnapshot::ERPSnapshot()
+    : totalEpochs   (0)
+{}
+
+void ERPSnapshot::resize(int numTriggers, int numChannels, int numSamples, double alpha,
+    double quantile, int window)
+{
+    lfp.resize(numTriggers, numChannels, numSamples, alpha, true); // with error bands
+    lfp.setQuantile(quantile);
+    lfp.setWindow(window);
+    stats.resize(numTriggers, numChannels, NUM_STATISTICS, alpha);
+    stats.setWindow(window);
+    envelope.resize(numTriggers, numChannels, numSamples);
+    epochCount.assign(std::max(0, numTriggers), 0);
+    totalEpochs = 0;
+}
+
+void ERPSnapshot::reset()
+{
+    lfp.reset();
+    stats.reset();
+    envelope.reset();
+    std::fill(epochCount.begin(), epochCount.end(), 0);
+    totalEpochs = 0;
+}
+
+void ERPSnapshot::resetTrigger(int trigger)
+{
+    lfp.resetTrigger(trigger);
+    stats.resetTrigger(trigger);
+    envelope.resetTrigger(trigger);
+    totalEpochs -= epochCount[trigger];
+    epochCount[trigger] = 0;
+}
+
+void ERPSnapshot::copyChangedFrom(const ERPSnapshot& other)
+{
+    lfp.copyChangedFrom(other.lfp);
+    stats.copyChangedFrom(other.stats);
+    envelope.copyChangedFrom(other.envelope);
+
+    epochCount = other.epochCount; // one counter per trigger, doesn't allocate once sized
+    totalEpochs = other.totalEpochs;
+}
@@ -0,0 +1,84 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef ERP_SNAPSHOT_H_INCLUDED
+#define ERP_SNAPSHOT_H_INCLUDED
+
+#include "AccumulatorStore.h"
+#include "EnvelopePyramid.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+* Everything the processor publishes to the visualizer, kept together so that it can be
+* shared through a single AtomicallyShared<ERPSnapshot>. A reader always sees a waveform
+* and statistics that come from the same set of epochs.
+*/
+
+namespace RealTimeERP
+{
+    struct ERPSnapshot
+    {
+        // Per-epoch statistics (the sample index of the stats store)
+        enum Statistic
+        {
+            AREA_UNDER_CURVE = 0,
+            PEAK_HEIGHT,
+            TIME_TO_PEAK, // in samples
+            NUM_STATISTICS
+        };
+
+        AccumulatorStore lfp;   // Average waveform and its variance (trigger x channel x sample)
+        AccumulatorStore stats; // Average of each Statistic (trigger x channel x statistic)
+        EnvelopePyramid envelope; // Min/max of lfp at several resolutions, for drawing it
+
+        std::vector<uint64_t> epochCount; // Completed epochs since the last reset (trigger)
+        uint64_t totalEpochs; // Completed epochs of all triggers since the last reset
+
+        ERPSnapshot();
+
+        /** Resizes and clears everything. With a quantile in (0, 1), the waveform is that
+            quantile of the epochs instead of their mean; with a window, everything only covers
+            the last window epochs of each trigger (see AccumulatorStore). */
+        void resize(int numTriggers, int numChannels, int numSamples, double alpha,
+            double quantile = -1, int window = 0);
+
+        /** Clears everything, keeping the dimensions */
+        void reset();
+
+        /** Clears the data of one trigger */
+        void resetTrigger(int trigger);
+
+        /** Brings this snapshot up to date with another, copying only the triggers that changed */
+        void copyChangedFrom(const ERPSnapshot& other);
+
+        /** Changes whenever any data changes */
+        uint64_t getVersion() const { return lfp.getVersion() + stats.getVersion(); }
+
+        /** Changes whenever the data of the trigger changes */
+        uint64_t getVersion(int trigger) const { return lfp.getVersion(trigger) + stats.getVersion(trigger); }
+    };
+}
+
+#endif // ERP_SNAPSHOT_H_INCLUDED
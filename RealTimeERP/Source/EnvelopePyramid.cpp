@@ -0,0 +1,283 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "EnvelopePyramid.h"
+#include "SimdKernels.h"
+
+#include <algorithm>
+
+using namespace RealTimeERP;
+
+EnvelopePyramid::EnvelopePyramid()
+    : numTriggers   (0)
+    , numChannels   (0)
+    , numSamples    (0)
+    , rowLength     (0)
+{}
+
+void EnvelopePyramid::resize(int nTriggers, int nChannels, int nSamples)
+{
+    numTriggers = std::max(0, nTriggers);
+    numChannels = std::max(0, nChannels);
+    numSamples = std::max(0, nSamples);
+
+    levelOffsets.clear();
+    rowLength = 0;
+    for (int level = 0; numSamples > 0 && (level == 0 || getNumBuckets(level) >= minBuckets); ++level)
+    {
+        levelOffsets.push_back(rowLength);
+        rowLength += getNumBuckets(level);
+    }
+
+    size_t size = size_t(numTriggers) * numChannels * rowLength;
+    minima.assign(size, 0.0f);
+    maxima.assign(size, 0.0f);
+    maxM2.assign(size, 0.0f);
+    versions.assign(numTriggers, 0);
+    validSamples.assign(numTriggers, 0);
+    dirtyStart.assign(numTriggers, 0);
+    dirtyEnd.assign(numTriggers, 0);
+}
+
+void EnvelopePyramid::reset()
+{
+    for (int t = 0; t < numTriggers; ++t)
+    {
+        resetTrigger(t);
+    }
+}
+
+void EnvelopePyramid::resetTrigger(int trigger)
+{
+    validSamples[trigger] = 0;
+    dirtyStart[trigger] = dirtyEnd[trigger] = 0;
+    ++versions[trigger];
+}
+
+void EnvelopePyramid::markDirty(int trigger, int offset, int n)
+{
+    if (offset <= validSamples[trigger] && offset + n > validSamples[trigger])
+    {
+        validSamples[trigger] = std::min(numSamples, offset + n);
+    }
+
+    if (dirtyEnd[trigger] <= dirtyStart[trigger])
+    {
+        dirtyStart[trigger] = offset;
+        dirtyEnd[trigger] = offset + n;
+    }
+    else
+    {
+        dirtyStart[trigger] = std::min(dirtyStart[trigger], offset);
+        dirtyEnd[trigger] = std::max(dirtyEnd[trigger], offset + n);
+    }
+}
+
+void EnvelopePyramid::updateBase(const AccumulatorStore& source, int trigger, int channel, int offset, int n)
+{
+    if (n <= 0 || rowLength == 0)
+    {
+        return;
+    }
+
+    // Samples at or past `valid` count as 0 (the new ones may not be marked valid yet)
+    int valid = std::min(numSamples, std::max(source.getValidSamples(trigger), offset + n));
+    const double* avg = source.getAverages(trigger, channel);
+    const double* m2 = source.hasVariance() ? source.getM2(trigger, channel) : nullptr;
+
+    int first = offset / baseBucketSize;
+    int last = (std::min(numSamples, offset + n) - 1) / baseBucketSize;
+    size_t row = getRowStart(trigger, channel, 0);
+    float* rowMin = minima.data() + row;
+    float* rowMax = maxima.data() + row;
+    float* rowM2 = maxM2.data() + row;
+
+    // Buckets with only valid samples (most of them)
+    int b = std::max(first, std::min(last + 1, valid / baseBucketSize));
+    if (b > first)
+    {
+        Kernels::bucketMinMax(avg + first * baseBucketSize, b - first, rowMin + first, rowMax + first);
+        if (m2 != nullptr)
+        {
+            Kernels::bucketMinMax(m2 + first * baseBucketSize, b - first, nullptr, rowM2 + first);
+        }
+        else
+        {
+            std::fill(rowM2 + first, rowM2 + b, 0.0f);
+        }
+    }
+
+    // The rest, which run past the valid samples or the end
+    for (; b <= last; ++b)
+    {
+        int start = b * baseBucketSize;
+        int end = std::min(start + baseBucketSize, numSamples);
+        double lo = start < valid ? avg[start] : 0.0;
+        double hi = lo;
+        double spread = 0;
+        for (int s = start; s < end; ++s)
+        {
+            double x = s < valid ? avg[s] : 0.0;
+            lo = std::min(lo, x);
+            hi = std::max(hi, x);
+            if (m2 != nullptr && s < valid)
+            {
+                spread = std::max(spread, m2[s]);
+            }
+        }
+        rowMin[b] = float(lo);
+        rowMax[b] = float(hi);
+        rowM2[b] = float(spread);
+    }
+}
+
+void EnvelopePyramid::updateDirty()
+{
+    for (int t = 0; t < numTriggers; ++t)
+    {
+        if (dirtyEnd[t] > dirtyStart[t])
+        {
+            for (int c = 0; c < numChannels; ++c)
+            {
+                updateLevels(t, c, dirtyStart[t], dirtyEnd[t] - dirtyStart[t]);
+            }
+            dirtyStart[t] = dirtyEnd[t] = 0;
+            ++versions[t];
+        }
+    }
+}
+
+void EnvelopePyramid::updateTrigger(const AccumulatorStore& source, int trigger)
+{
+    for (int c = 0; c < numChannels; ++c)
+    {
+        updateBase(source, trigger, c, 0, numSamples);
+        updateLevels(trigger, c, 0, numSamples);
+    }
+    validSamples[trigger] = numSamples; // (including the buckets of samples that count as 0)
+    dirtyStart[trigger] = dirtyEnd[trigger] = 0;
+    ++versions[trigger];
+}
+
+void EnvelopePyramid::updateLevels(int trigger, int channel, int offset, int n)
+{
+    if (n <= 0 || rowLength == 0)
+    {
+        return;
+    }
+
+    int first = offset / baseBucketSize;
+    int last = (std::min(numSamples, offset + n) - 1) / baseBucketSize;
+    int valid = std::max(validSamples[trigger], std::min(numSamples, offset + n));
+    size_t row = getRowStart(trigger, channel, 0);
+    const float* belowMin = minima.data() + row;
+    const float* belowMax = maxima.data() + row;
+    const float* belowM2 = maxM2.data() + row;
+
+    // Each level from pairs of buckets of the one below
+    for (int level = 1; level < getNumLevels(); ++level)
+    {
+        int numBelow = getNumBuckets(level - 1);
+        row = getRowStart(trigger, channel, level);
+        float* rowMin = minima.data() + row;
+        float* rowMax = maxima.data() + row;
+        float* rowM2 = maxM2.data() + row;
+        first /= 2;
+        last /= 2;
+
+        // (the last bucket of a level with an odd number of buckets has no pair, and a bucket
+        // whose pair is past the valid ones gets its zeros)
+        int numValidBelow = (valid + getBucketSize(level - 1) - 1) / getBucketSize(level - 1);
+        int lastPair = std::min(last, std::min(numBelow, numValidBelow) / 2 - 1);
+        int b = first;
+        for (; b <= lastPair; ++b)
+        {
+            rowMin[b] = std::min(belowMin[2 * b], belowMin[2 * b + 1]);
+            rowMax[b] = std::max(belowMax[2 * b], belowMax[2 * b + 1]);
+            rowM2[b] = std::max(belowM2[2 * b], belowM2[2 * b + 1]);
+        }
+        for (; b <= last; ++b)
+        {
+            bool pairIsZero = 2 * b + 1 < numBelow;
+            rowMin[b] = pairIsZero ? std::min(belowMin[2 * b], 0.0f) : belowMin[2 * b];
+            rowMax[b] = pairIsZero ? std::max(belowMax[2 * b], 0.0f) : belowMax[2 * b];
+            rowM2[b] = belowM2[2 * b];
+        }
+
+        belowMin = rowMin;
+        belowMax = rowMax;
+        belowM2 = rowM2;
+    }
+}
+
+int EnvelopePyramid::getLevelFor(int numBuckets) const
+{
+    int level = -1;
+    while (level + 1 < getNumLevels() && getNumBuckets(level + 1) >= numBuckets)
+    {
+        ++level;
+    }
+    return level;
+}
+
+void EnvelopePyramid::copyChangedFrom(const EnvelopePyramid& other)
+{
+    if (numTriggers != other.numTriggers || numChannels != other.numChannels
+        || numSamples != other.numSamples)
+    {
+        *this = other;
+        return;
+    }
+
+    size_t triggerSize = size_t(numChannels) * rowLength;
+    for (int t = 0; t < numTriggers; ++t)
+    {
+        if (versions[t] != other.versions[t])
+        {
+            if (other.validSamples[t] == numSamples)
+            {
+                size_t start = t * triggerSize;
+                std::copy(other.minima.begin() + start, other.minima.begin() + start + triggerSize, minima.begin() + start);
+                std::copy(other.maxima.begin() + start, other.maxima.begin() + start + triggerSize, maxima.begin() + start);
+                std::copy(other.maxM2.begin() + start, other.maxM2.begin() + start + triggerSize, maxM2.begin() + start);
+            }
+            else
+            {
+                // the rest of each level is stale anyway
+                for (int c = 0; c < numChannels; ++c)
+                {
+                    for (int level = 0; level < getNumLevels(); ++level)
+                    {
+                        size_t start = getRowStart(t, c, level);
+                        size_t end = start + other.getNumValidBuckets(t, level);
+                        std::copy(other.minima.begin() + start, other.minima.begin() + end, minima.begin() + start);
+                        std::copy(other.maxima.begin() + start, other.maxima.begin() + end, maxima.begin() + start);
+                        std::copy(other.maxM2.begin() + start, other.maxM2.begin() + end, maxM2.begin() + start);
+                    }
+                }
+            }
+            validSamples[t] = other.validSamples[t];
+            versions[t] = other.versions[t];
+        }
+    }
+}
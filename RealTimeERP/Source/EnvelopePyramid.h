@@ -0,0 +1,151 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef ENVELOPE_PYRAMID_H_INCLUDED
+#define ENVELOPE_PYRAMID_H_INCLUDED
+
+#include "AccumulatorStore.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+* EnvelopePyramid keeps, for every (trigger, channel) waveform of an AccumulatorStore, the
+* minimum and maximum of the average (and the largest value of its second plane, for error
+* bands) over buckets of samples, at several resolutions: level 0 has buckets of
+* baseBucketSize samples and each level above halves the number of buckets, as long as it
+* keeps at least minBuckets (coarser levels would be narrower than any plot, and each would
+* cost a cache miss or so per plane on every update).
+*
+* A display draws the coarsest level with at least as many buckets as it has pixels, so the
+* data it reads and draws depends on its width rather than on the epoch length and sample
+* rate. The pyramid is updated incrementally, in two steps, as most of the cost is in memory
+* traffic rather than arithmetic (the averages of all channels don't fit in the cache):
+* updateBase() recomputes the level 0 buckets over samples that were just added, while they
+* are still in the cache, and markDirty() records them; updateDirty() later (e.g. once per
+* update of the display) recomputes the buckets above them from level 0, which is an eighth
+* of the samples in floats instead of doubles.
+*
+* Samples past the valid ones of a trigger count as 0, as in AccumulatorStore::getAverage.
+* Like there, resetting only marks a trigger empty: buckets past getNumValidBuckets() may hold
+* stale data, and stand for all 0 (minimum, maximum and second plane).
+*/
+
+namespace RealTimeERP
+{
+    class EnvelopePyramid
+    {
+    public:
+        static const int baseBucketSize = 8; // (the bucket size of Kernels::bucketMinMax)
+        static const int minBuckets = 256;
+
+        EnvelopePyramid();
+
+        /** Sets the dimensions and clears everything */
+        void resize(int numTriggers, int numChannels, int numSamples);
+
+        /** Clears all triggers (cheap: marks them empty instead of zeroing the buckets) */
+        void reset();
+
+        /** Clears one trigger (as cheaply) */
+        void resetTrigger(int trigger);
+
+        /** Updates the level 0 buckets covering samples [offset, offset + n) of one channel of
+            the trigger from the source (which must have the same dimensions), e.g. right after
+            they were added to it. Only touches that channel's rows, so different channels can be
+            updated from different threads. Call markDirty() for the trigger afterwards. */
+        void updateBase(const AccumulatorStore& source, int trigger, int channel, int offset, int n);
+
+        /** Records that samples [offset, offset + n) of the trigger changed in level 0 (and
+            extends the valid buckets over them if they follow on from the valid ones) */
+        void markDirty(int trigger, int offset, int n);
+
+        /** Updates the buckets above level 0 covering the samples marked dirty since the last
+            update */
+        void updateDirty();
+
+        /** Updates every bucket of the trigger from the source */
+        void updateTrigger(const AccumulatorStore& source, int trigger);
+
+        /** Copies only the triggers whose versions differ from those of the source (or
+            everything, if the dimensions differ) */
+        void copyChangedFrom(const EnvelopePyramid& other);
+
+        int getNumTriggers() const { return numTriggers; }
+        int getNumChannels() const { return numChannels; }
+        int getNumSamples() const { return numSamples; }
+
+        int getNumLevels() const { return int(levelOffsets.size()); }
+        int getBucketSize(int level) const { return baseBucketSize << level; }
+        int getNumBuckets(int level) const { return (numSamples + getBucketSize(level) - 1) / getBucketSize(level); }
+
+        /** Coarsest level with at least numBuckets buckets (the coarsest one if they all have
+            more), or -1 if even level 0 has fewer (then the samples themselves are about as
+            cheap to draw) */
+        int getLevelFor(int numBuckets) const;
+
+        /** Number of buckets of the level (from the start) that hold data since the trigger
+            was last reset; the rest count as 0 */
+        int getNumValidBuckets(int trigger, int level) const
+        {
+            return (validSamples[trigger] + getBucketSize(level) - 1) / getBucketSize(level);
+        }
+
+        /** Smallest and largest average in each bucket of the level (getNumBuckets(level) long,
+            of which the first getNumValidBuckets() are meaningful) */
+        const float* getMin(int trigger, int channel, int level) const { return minima.data() + getRowStart(trigger, channel, level); }
+        const float* getMax(int trigger, int channel, int level) const { return maxima.data() + getRowStart(trigger, channel, level); }
+
+        /** Largest value of the source's second plane in each bucket of the level, e.g. for
+            AccumulatorStore::getStandardErrorOf (0 if it has none) */
+        const float* getMaxM2(int trigger, int channel, int level) const { return maxM2.data() + getRowStart(trigger, channel, level); }
+
+        uint64_t getVersion(int trigger) const { return versions[trigger]; }
+
+    private:
+        int numTriggers;
+        int numChannels;
+        int numSamples;
+        int rowLength; // buckets of all levels of one waveform
+
+        std::vector<int> levelOffsets; // start of each level within a row
+
+        size_t getRowStart(int trigger, int channel, int level) const
+        {
+            return (size_t(trigger) * numChannels + channel) * rowLength + levelOffsets[level];
+        }
+
+        // Updates the buckets above level 0 covering samples [offset, offset + n) of one channel
+        void updateLevels(int trigger, int channel, int offset, int n);
+
+        std::vector<float> minima; // trigger x channel x (level 0 buckets, level 1 buckets, ...)
+        std::vector<float> maxima; // same layout
+        std::vector<float> maxM2; // same layout
+        std::vector<uint64_t> versions; // trigger
+        std::vector<int> validSamples; // samples from the start the buckets cover (trigger)
+        std::vector<int> dirtyStart; // first sample changed since the last update (trigger)
+        std::vector<int> dirtyEnd; // past the last one (trigger; dirtyStart if none)
+    };
+}
+
+#endif // ENVELOPE_PYRAMID_H_INCLUDED
@@ -0,0 +1,457 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "EpochArchive.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace RealTimeERP;
+
+// How long the writer sleeps when there is nothing to write
+static const int writerIntervalMs = 5;
+
+// Buffers for completed epochs waiting to be written, on top of those for open epochs
+static const int writerBuffers = 8;
+
+// The file grows by at least this much at a time
+static const uint64_t minGrowBytes = uint64_t(64) << 20;
+
+/*********** MappedFile ***********/
+
+// A file with a view of its first `mappedSize` bytes
+struct EpochArchive::MappedFile
+{
+    char* data = nullptr;
+    uint64_t mappedSize = 0;
+    bool writable = false;
+
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+
+    // Creates (or replaces) the file if writable, otherwise opens an existing one
+    bool open(const std::string& path, bool forWriting)
+    {
+        // path is UTF-8
+        int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+        std::wstring widePath(std::max(length, 1), L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &widePath[0], length);
+
+        writable = forWriting;
+        handle = writable
+            ? CreateFileW(widePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr)
+            : CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        return handle != INVALID_HANDLE_VALUE;
+    }
+
+    uint64_t getFileSize() const
+    {
+        LARGE_INTEGER size;
+        return GetFileSizeEx(handle, &size) ? uint64_t(size.QuadPart) : 0;
+    }
+
+    // Maps the first size bytes, growing the file to fit if writable
+    bool map(uint64_t size)
+    {
+        unmap();
+        mapping = CreateFileMappingW(handle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+            DWORD(size >> 32), DWORD(size), nullptr);
+        if (mapping == NULL)
+        {
+            return false;
+        }
+        data = static_cast<char*>(MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+            0, 0, SIZE_T(size)));
+        mappedSize = data != nullptr ? size : 0;
+        return data != nullptr;
+    }
+
+    void unmap()
+    {
+        if (data != nullptr)
+        {
+            if (writable)
+            {
+                FlushViewOfFile(data, 0);
+            }
+            UnmapViewOfFile(data);
+            data = nullptr;
+        }
+        if (mapping != NULL)
+        {
+            CloseHandle(mapping);
+            mapping = NULL;
+        }
+        mappedSize = 0;
+    }
+
+    // Unmaps and closes the file, trimming it to size bytes first if writable
+    void close(uint64_t size = 0)
+    {
+        unmap();
+        if (writable)
+        {
+            LARGE_INTEGER end;
+            end.QuadPart = LONGLONG(size);
+            if (SetFilePointerEx(handle, end, nullptr, FILE_BEGIN))
+            {
+                SetEndOfFile(handle);
+            }
+        }
+        CloseHandle(handle);
+        handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    int fd = -1;
+
+    // Creates (or replaces) the file if writable, otherwise opens an existing one
+    bool open(const std::string& path, bool forWriting)
+    {
+        writable = forWriting;
+        fd = writable
+            ? ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)
+            : ::open(path.c_str(), O_RDONLY);
+        return fd >= 0;
+    }
+
+    uint64_t getFileSize() const
+    {
+        struct stat info;
+        return fstat(fd, &info) == 0 ? uint64_t(info.st_size) : 0;
+    }
+
+    // Maps the first size bytes, growing the file to fit if writable
+    bool map(uint64_t size)
+    {
+        unmap();
+        if (writable && ftruncate(fd, off_t(size)) != 0)
+        {
+            return false;
+        }
+        void* view = mmap(nullptr, size_t(size), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+            MAP_SHARED, fd, 0);
+        if (view == MAP_FAILED)
+        {
+            return false;
+        }
+        data = static_cast<char*>(view);
+        mappedSize = size;
+        return true;
+    }
+
+    void unmap()
+    {
+        if (data != nullptr)
+        {
+            munmap(data, size_t(mappedSize));
+            data = nullptr;
+        }
+        mappedSize = 0;
+    }
+
+    // Unmaps and closes the file, trimming it to size bytes first if writable
+    void close(uint64_t size = 0)
+    {
+        unmap();
+        if (writable && ftruncate(fd, off_t(size)) != 0)
+        {
+            // leaves the file longer than it needs to be; the header still has the record count
+        }
+        ::close(fd);
+        fd = -1;
+    }
+#endif
+};
+
+/*********** EpochArchive ***********/
+
+EpochArchive::EpochArchive()
+    : numChannels   (0)
+    , epochSamples  (0)
+    , epochFloats   (0)
+    , headerSize    (0)
+    , recordSize    (0)
+    , numBuffers    (0)
+    , bufferLimited (false)
+    , quit          (false)
+    , numWritten    (0)
+    , numDropped    (0)
+{}
+
+EpochArchive::~EpochArchive()
+{
+    close();
+}
+
+bool EpochArchive::open(const std::string& path, int numTriggers, const std::vector<int>& channels,
+    int nSamples, int preSamples, double sampleRate, int maxOpenEpochs, size_t bufferBytes)
+{
+    close();
+
+    numChannels = int(channels.size());
+    epochSamples = std::max(0, nSamples);
+    epochFloats = size_t(numChannels) * epochSamples;
+
+    // Channel table after the header, records starting on a 64-byte boundary
+    headerSize = (sizeof(FileHeader) + channels.size() * sizeof(int32_t) + 63) & ~uint64_t(63);
+    recordSize = (sizeof(RecordHeader) + epochFloats * sizeof(float) + 7) & ~uint64_t(7);
+
+    std::unique_ptr<MappedFile> newFile(new MappedFile);
+    uint64_t initialRecords = std::max<uint64_t>(4, minGrowBytes / recordSize);
+    if (!newFile->open(path, true))
+    {
+        return false;
+    }
+    if (!newFile->map(headerSize + initialRecords * recordSize))
+    {
+        newFile->close(0);
+        return false;
+    }
+
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "ERPEPOCH", 8);
+    header.version = 1;
+    header.headerSize = uint32_t(headerSize);
+    header.numTriggers = uint32_t(std::max(0, numTriggers));
+    header.numChannels = uint32_t(numChannels);
+    header.epochSamples = uint32_t(epochSamples);
+    header.preSamples = uint32_t(std::max(0, preSamples));
+    header.sampleRate = sampleRate;
+    header.recordSize = recordSize;
+    header.numRecords = 0;
+    std::memcpy(newFile->data, &header, sizeof(header));
+
+    int32_t* channelTable = reinterpret_cast<int32_t*>(newFile->data + sizeof(FileHeader));
+    for (size_t n = 0; n < channels.size(); ++n)
+    {
+        channelTable[n] = int32_t(channels[n]);
+    }
+
+    // A buffer for every epoch that can be open, if they fit (all start out free)
+    size_t neededBuffers = size_t(std::max(0, maxOpenEpochs)) + writerBuffers;
+    size_t affordableBuffers = std::max<size_t>(4, bufferBytes / std::max<size_t>(1, epochFloats * sizeof(float)));
+    numBuffers = int(std::min(neededBuffers, affordableBuffers));
+    bufferLimited = affordableBuffers < neededBuffers;
+    buffers.assign(size_t(numBuffers) * epochFloats, 0.0f);
+    freeBuffers.reset(new LockFreeQueue<int>(numBuffers));
+    pendingEpochs.reset(new LockFreeQueue<PendingEpoch>(numBuffers));
+    for (int b = 0; b < numBuffers; ++b)
+    {
+        freeBuffers->push(b);
+    }
+
+    file = std::move(newFile);
+    numWritten.store(0);
+    numDropped.store(0);
+    quit.store(false);
+    writer = std::thread(&EpochArchive::writerLoop, this);
+    return true;
+}
+
+void EpochArchive::close()
+{
+    if (!isOpen())
+    {
+        return;
+    }
+
+    // The writer writes everything that's queued before it stops
+    quit.store(true);
+    writer.join();
+
+    file->close(headerSize + numWritten.load() * recordSize);
+    file.reset();
+
+    buffers.clear();
+    buffers.shrink_to_fit();
+    freeBuffers.reset();
+    pendingEpochs.reset();
+}
+
+int EpochArchive::acquireBuffer()
+{
+    int buffer;
+    if (!freeBuffers->pop(buffer))
+    {
+        numDropped.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+    return buffer;
+}
+
+void EpochArchive::commitBuffer(int buffer, int trigger, int64_t timestamp)
+{
+    // There are as many queue slots as buffers, so this can't fail
+    pendingEpochs->push({ buffer, std::max(0, trigger), timestamp });
+}
+
+void EpochArchive::discardBuffer(int buffer)
+{
+    pendingEpochs->push({ buffer, -1, 0 });
+}
+
+void EpochArchive::writerLoop()
+{
+    while (true)
+    {
+        // checked before draining, so that nothing queued before close() is left behind
+        bool stopping = quit.load();
+
+        PendingEpoch epoch;
+        while (pendingEpochs->pop(epoch))
+        {
+            if (epoch.trigger >= 0 && !writeRecord(epoch))
+            {
+                numDropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            freeBuffers->push(epoch.buffer);
+        }
+
+        if (stopping)
+        {
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(writerIntervalMs));
+    }
+}
+
+bool EpochArchive::writeRecord(const PendingEpoch& epoch)
+{
+    uint64_t index = numWritten.load(std::memory_order_relaxed);
+    uint64_t end = headerSize + (index + 1) * recordSize;
+
+    if (end > file->mappedSize)
+    {
+        // Double the file (remapping may move the view, so nothing keeps pointers into it)
+        uint64_t grown = std::max(end, file->mappedSize + std::max(file->mappedSize - headerSize, minGrowBytes));
+        if (!file->map(grown) && !file->map(end))
+        {
+            return false;
+        }
+    }
+
+    char* record = file->data + headerSize + index * recordSize;
+    RecordHeader recordHeader;
+    recordHeader.trigger = int32_t(epoch.trigger);
+    recordHeader.reserved = 0;
+    recordHeader.timestamp = epoch.timestamp;
+    std::memcpy(record, &recordHeader, sizeof(recordHeader));
+    std::memcpy(record + sizeof(RecordHeader), buffers.data() + size_t(epoch.buffer) * epochFloats,
+        epochFloats * sizeof(float));
+
+    // Publish the record in the header
+    numWritten.store(index + 1, std::memory_order_relaxed);
+    reinterpret_cast<FileHeader*>(file->data)->numRecords = index + 1;
+    return true;
+}
+
+/*********** EpochArchiveReader ***********/
+
+EpochArchiveReader::EpochArchiveReader()
+    : numRecords    (0)
+{
+    std::memset(&header, 0, sizeof(header));
+}
+
+EpochArchiveReader::~EpochArchiveReader()
+{
+    close();
+}
+
+bool EpochArchiveReader::open(const std::string& path)
+{
+    close();
+
+    std::unique_ptr<EpochArchive::MappedFile> newFile(new EpochArchive::MappedFile);
+    if (!newFile->open(path, false))
+    {
+        return false;
+    }
+
+    uint64_t fileSize = newFile->getFileSize();
+    if (fileSize < sizeof(EpochArchive::FileHeader) || !newFile->map(fileSize))
+    {
+        newFile->close();
+        return false;
+    }
+
+    // Check that the header is one of ours and the records fit in it
+    EpochArchive::FileHeader newHeader;
+    std::memcpy(&newHeader, newFile->data, sizeof(newHeader));
+    uint64_t channelTableEnd = sizeof(newHeader) + uint64_t(newHeader.numChannels) * sizeof(int32_t);
+    uint64_t samplesSize = uint64_t(newHeader.numChannels) * newHeader.epochSamples * sizeof(float);
+    if (std::memcmp(newHeader.magic, "ERPEPOCH", 8) != 0 || newHeader.version != 1
+        || newHeader.headerSize < channelTableEnd || newHeader.headerSize > fileSize
+        || newHeader.recordSize < sizeof(EpochArchive::RecordHeader) + samplesSize
+        || newHeader.preSamples > newHeader.epochSamples)
+    {
+        newFile->close();
+        return false;
+    }
+
+    header = newHeader;
+    const int32_t* channelTable = reinterpret_cast<const int32_t*>(newFile->data + sizeof(header));
+    channels.assign(channelTable, channelTable + header.numChannels);
+
+    // (a file that was never closed may end with part of a record)
+    numRecords = std::min(header.numRecords, (fileSize - header.headerSize) / header.recordSize);
+    file = std::move(newFile);
+    return true;
+}
+
+void EpochArchiveReader::close()
+{
+    if (file != nullptr)
+    {
+        file->close();
+        file.reset();
+    }
+    channels.clear();
+    numRecords = 0;
+}
+
+const char* EpochArchiveReader::getRecordStart(uint64_t record) const
+{
+    return file->data + header.headerSize + record * header.recordSize;
+}
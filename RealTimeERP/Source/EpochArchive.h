@@ -0,0 +1,231 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef EPOCH_ARCHIVE_H_INCLUDED
+#define EPOCH_ARCHIVE_H_INCLUDED
+
+#include "LockFreeQueue.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+* EpochArchive appends every completed single-trial epoch to a binary file, so that a session
+* can be re-analyzed later without going back to the continuous data.
+*
+* The file is a FileHeader, the (input) channel numbers of the archived channels (numChannels int32s,
+* padded so records start at headerSize), then fixed-size records: a RecordHeader (trigger and
+* timestamp of the first sample) followed by the raw samples, numChannels x epochSamples
+* floats, channel by channel. Since every record has the same size, record i is at
+* headerSize + i * recordSize. All values are in the machine's native (little-endian) order.
+*
+* Epochs are filled on the audio thread in buffers that are allocated by open(), then written
+* into a memory-mapped view of the file by a writer thread, so the audio thread never waits
+* on the disk. Buffers go round between the two threads through a pair of LockFreeQueues:
+*
+*     audio thread:  acquireBuffer() -> fill getBuffer() -> commitBuffer() (or discardBuffer())
+*     writer thread: copies committed buffers to the file, then gives them back
+*
+* Every open epoch holds a buffer until it completes, so open() allocates one for each epoch
+* that can be open at once plus a few for epochs waiting to be written, unless that would take
+* more than bufferBytes (then isBufferLimited() says so, and the caller should warn that
+* overlapping epochs beyond getNumBuffers() won't be archived). If no buffer is free,
+* acquireBuffer() returns -1 and the epoch isn't archived (getNumDropped() counts these). The mapping grows as records are added, and
+* the header's record count is updated after each one, so the file is readable even if the
+* plugin stops abruptly; close() trims the file to the records written.
+*
+* open() and close() allocate and must not be called while the audio thread uses the archive.
+*
+* EpochArchiveReader maps an archive read-only, for replaying it (see ERPEngine::replay).
+*/
+
+namespace RealTimeERP
+{
+    class EpochArchive
+    {
+    public:
+        struct FileHeader
+        {
+            char magic[8];          // "ERPEPOCH"
+            uint32_t version;       // currently 1
+            uint32_t headerSize;    // bytes before the first record
+            uint32_t numTriggers;
+            uint32_t numChannels;
+            uint32_t epochSamples;  // whole epoch, including the pre-trigger window
+            uint32_t preSamples;    // pre-trigger window
+            double sampleRate;
+            uint64_t recordSize;    // bytes per record
+            uint64_t numRecords;    // records written so far
+            uint64_t reserved;
+        };
+
+        struct RecordHeader
+        {
+            int32_t trigger;
+            uint32_t reserved;
+            int64_t timestamp;      // of the first sample of the epoch (preSamples before the trigger)
+        };
+
+        EpochArchive();
+
+        /** Closes the file, if open */
+        ~EpochArchive();
+
+        EpochArchive(const EpochArchive&) = delete;
+        EpochArchive& operator=(const EpochArchive&) = delete;
+
+        /** Creates (or replaces) the file and starts the writer thread. channels holds the
+            channel number of each archived channel. Returns false if the file can't be created.
+            @param maxOpenEpochs  most epochs (of all triggers) that can be open at once, e.g.
+                                  ERPEngine::getMaxOpenEpochs()
+            @param bufferBytes    most memory for epoch buffers (at least 4 are allocated)
+        */
+        bool open(const std::string& path, int numTriggers, const std::vector<int>& channels,
+            int epochSamples, int preSamples, double sampleRate, int maxOpenEpochs,
+            size_t bufferBytes = 256 << 20);
+
+        /** Writes the remaining epochs, trims the file and closes it */
+        void close();
+
+        bool isOpen() const { return file != nullptr; }
+
+        int getNumChannels() const { return numChannels; }
+        int getEpochSamples() const { return epochSamples; }
+
+        /** Number of epoch buffers */
+        int getNumBuffers() const { return numBuffers; }
+
+        /** True if bufferBytes didn't cover a buffer for every epoch that can be open (and a
+            few waiting to be written), so epochs may be dropped when many of them overlap */
+        bool isBufferLimited() const { return bufferLimited; }
+
+        /** Number of epochs written to the file */
+        uint64_t getNumWritten() const { return numWritten.load(std::memory_order_relaxed); }
+
+        /** Number of epochs that couldn't be archived (no free buffer, or the file couldn't grow) */
+        uint64_t getNumDropped() const { return numDropped.load(std::memory_order_relaxed); }
+
+        // Audio thread
+
+        /** Returns a free buffer to fill with an epoch, or -1 if there is none */
+        int acquireBuffer();
+
+        /** Samples of the epoch in a buffer: channel n starts at getBuffer(buffer) + n * epochSamples */
+        float* getBuffer(int buffer) { return buffers.data() + size_t(buffer) * epochFloats; }
+
+        /** Queues a filled buffer to be written (and then freed) */
+        void commitBuffer(int buffer, int trigger, int64_t timestamp);
+
+        /** Frees a buffer without writing it */
+        void discardBuffer(int buffer);
+
+    private:
+        struct PendingEpoch
+        {
+            int buffer;
+            int trigger; // < 0 to just free the buffer
+            int64_t timestamp;
+        };
+
+        // Writer thread
+        void writerLoop();
+        bool writeRecord(const PendingEpoch& epoch);
+
+        friend class EpochArchiveReader;
+        struct MappedFile; // platform specific
+        std::unique_ptr<MappedFile> file;
+
+        int numChannels;
+        int epochSamples;
+        size_t epochFloats;
+        uint64_t headerSize;
+        uint64_t recordSize;
+
+        int numBuffers;
+        bool bufferLimited;
+        std::vector<float> buffers; // buffer x channel x sample
+        std::unique_ptr<LockFreeQueue<int>> freeBuffers; // writer thread -> audio thread
+        std::unique_ptr<LockFreeQueue<PendingEpoch>> pendingEpochs; // audio thread -> writer thread
+
+        std::thread writer;
+        std::atomic<bool> quit;
+        std::atomic<uint64_t> numWritten;
+        std::atomic<uint64_t> numDropped;
+    };
+
+    class EpochArchiveReader
+    {
+    public:
+        EpochArchiveReader();
+        ~EpochArchiveReader();
+
+        EpochArchiveReader(const EpochArchiveReader&) = delete;
+        EpochArchiveReader& operator=(const EpochArchiveReader&) = delete;
+
+        /** Maps an archive written by EpochArchive. Returns false if the file can't be read or
+            isn't an archive. */
+        bool open(const std::string& path);
+        void close();
+
+        bool isOpen() const { return file != nullptr; }
+
+        int getNumTriggers() const { return int(header.numTriggers); }
+        int getNumChannels() const { return int(header.numChannels); }
+        int getEpochSamples() const { return int(header.epochSamples); }
+        int getPreSamples() const { return int(header.preSamples); }
+        double getSampleRate() const { return header.sampleRate; }
+
+        /** Channel number of archived channel n */
+        int getChannel(int n) const { return channels[n]; }
+
+        /** Number of complete records in the file */
+        uint64_t getNumRecords() const { return numRecords; }
+
+        const EpochArchive::RecordHeader& getRecord(uint64_t record) const
+        {
+            return *reinterpret_cast<const EpochArchive::RecordHeader*>(getRecordStart(record));
+        }
+
+        /** Samples of archived channel n of a record (getEpochSamples() long) */
+        const float* getSamples(uint64_t record, int n) const
+        {
+            return reinterpret_cast<const float*>(getRecordStart(record) + sizeof(EpochArchive::RecordHeader))
+                + size_t(n) * header.epochSamples;
+        }
+
+    private:
+        const char* getRecordStart(uint64_t record) const;
+
+        std::unique_ptr<EpochArchive::MappedFile> file;
+        EpochArchive::FileHeader header;
+        std::vector<int> channels;
+        uint64_t numRecords;
+    };
+}
+
+#endif // EPOCH_ARCHIVE_H_INCLUDED
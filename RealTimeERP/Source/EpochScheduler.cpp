@@ -0,0 +1,95 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "EpochScheduler.h"
+
+using namespace RealTimeERP;
+
+EpochScheduler::EpochScheduler()
+    : numTriggers   (0)
+    , epochLength   (0)
+{}
+
+void EpochScheduler::resize(int nTriggers, int64_t length, int maxOpenEpochs)
+{
+    numTriggers = nTriggers;
+    epochLength = length;
+
+    epochs.assign(numTriggers, EventRing<Epoch>());
+    for (int t = 0; t < numTriggers; ++t)
+    {
+        epochs[t].setCapacity(std::max(1, maxOpenEpochs));
+    }
+}
+
+void EpochScheduler::reset()
+{
+    for (int t = 0; t < numTriggers; ++t)
+    {
+        resetTrigger(t);
+    }
+}
+
+void EpochScheduler::resetTrigger(int trigger)
+{
+    epochs[trigger].clear();
+}
+
+bool EpochScheduler::addEvent(int trigger, int64_t timestamp)
+{
+    if (trigger < 0 || trigger >= numTriggers || epochLength <= 0)
+    {
+        return false;
+    }
+
+    Epoch epoch;
+    epoch.start = timestamp;
+    epoch.filled = 0;
+
+    return epochs[trigger].push(epoch);
+}
+
+int EpochScheduler::getNumTriggers() const
+{
+    return numTriggers;
+}
+
+int64_t EpochScheduler::getEpochLength() const
+{
+    return epochLength;
+}
+
+int EpochScheduler::getNumOpenEpochs(int trigger) const
+{
+    return epochs[trigger].size();
+}
+
+int EpochScheduler::getNumSlots() const
+{
+    return numTriggers > 0 ? epochs[0].getCapacity() : 0;
+}
+
+uint64_t EpochScheduler::getNumDroppedEvents(int trigger) const
+{
+    return epochs[trigger].getNumDropped();
+}
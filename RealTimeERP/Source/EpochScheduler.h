@@ -0,0 +1,177 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef EPOCH_SCHEDULER_H_INCLUDED
+#define EPOCH_SCHEDULER_H_INCLUDED
+
+#include "EventRing.h"
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+/*
+* EpochScheduler keeps track of every epoch (window of ERPLenSamps samples following a
+* trigger) that is still being filled, for each trigger, so that triggers arriving faster
+* than the window length produce overlapping epochs instead of queueing up behind each other.
+*
+* For each incoming block, forEachSlice() calls back once per open epoch that overlaps the
+* block with the range of block samples belonging to that epoch and where they go in the
+* epoch. Work per block is proportional to the number of open epochs.
+*
+* Open epochs live in a fixed-capacity EventRing per trigger, so adding and closing epochs
+* is O(1) and never allocates once resize() has been called. If more than maxOpenEpochs
+* epochs of one trigger overlap, further events are dropped (and counted) until one completes.
+*
+* Each open epoch is assigned a "slot" index in [0, getNumSlots()) which stays the same until
+* the epoch completes, and is then recycled. Callers can use it to index per-epoch storage.
+*/
+
+namespace RealTimeERP
+{
+    class EpochScheduler
+    {
+    public:
+        struct Slice
+        {
+            int trigger;
+            int slot;            // per-trigger storage slot of the epoch
+            int64_t epochOffset; // index within the epoch of the first sample of this slice
+            int bufferStart;     // index within the block of the first sample of this slice (< 0: before the block)
+            int numSamples;
+            bool startsEpoch;    // true if this slice contains the first sample of the epoch
+            bool completesEpoch; // true if this slice contains the last sample of the epoch
+        };
+
+        EpochScheduler();
+
+        /** Drops all epochs and sets the number of triggers, the epoch length (in samples) and
+            how many epochs of each trigger can be open at once. Allocates, so call it from
+            updateSettings() rather than the audio thread. */
+        void resize(int numTriggers, int64_t epochLength, int maxOpenEpochs = 64);
+
+        /** Drops all open epochs, keeping the configuration */
+        void reset();
+
+        /** Drops the open epochs of one trigger */
+        void resetTrigger(int trigger);
+
+        /** Opens a new epoch for the given trigger starting at the given timestamp.
+            Returns false if the trigger already has the maximum number of open epochs. */
+        bool addEvent(int trigger, int64_t timestamp);
+
+        int getNumTriggers() const;
+        int64_t getEpochLength() const;
+        int getNumOpenEpochs(int trigger) const;
+
+        /** Number of distinct slots (the same for every trigger) */
+        int getNumSlots() const;
+
+        /** Number of events of the trigger dropped because too many epochs were open */
+        uint64_t getNumDroppedEvents(int trigger) const;
+
+        /** Calls f(const Slice&) for every open epoch that has samples in the block
+            [blockTimestamp, blockTimestamp + numSamples), oldest epoch first within each
+            trigger. Completed epochs are closed after the callback for their last slice.
+            An epoch whose trigger timestamp precedes the first block it is seen in
+            starts at that block instead.
+        */
+        template<typename F>
+        void forEachSlice(int64_t blockTimestamp, int numSamples, F&& f)
+        {
+            forEachSlice(blockTimestamp, numSamples, blockTimestamp, f);
+        }
+
+        /** Same, but the caller also has the samples from earliestTimestamp up to the block
+            (e.g. in a history buffer), so epochs may start that far back. A slice's bufferStart
+            is then negative if it starts before the block.
+        */
+        template<typename F>
+        void forEachSlice(int64_t blockTimestamp, int numSamples, int64_t earliestTimestamp, F&& f)
+        {
+            if (numSamples <= 0)
+            {
+                return;
+            }
+
+            const int64_t blockEnd = blockTimestamp + numSamples;
+
+            for (int t = 0; t < numTriggers; ++t)
+            {
+                EventRing<Epoch>& open = epochs[t];
+                const int nOpen = open.size();
+
+                for (int i = 0; i < nOpen; ++i)
+                {
+                    Epoch& epoch = open[i];
+                    if (epoch.start >= blockEnd || epoch.filled >= epochLength)
+                    {
+                        continue; // in the future (nothing to fill yet) or already complete
+                    }
+
+                    if (epoch.filled == 0 && epoch.start < earliestTimestamp)
+                    {
+                        epoch.start = earliestTimestamp; // late event, start as early as we can
+                    }
+
+                    Slice slice;
+                    slice.trigger = t;
+                    slice.slot = open.getSlot(i);
+                    slice.epochOffset = epoch.filled;
+                    // (clamped in case of a gap in the incoming timestamps)
+                    slice.bufferStart = int(std::max<int64_t>(earliestTimestamp - blockTimestamp,
+                        epoch.start + epoch.filled - blockTimestamp));
+                    slice.numSamples = int(std::min<int64_t>(epochLength - epoch.filled,
+                        numSamples - slice.bufferStart));
+                    slice.startsEpoch = epoch.filled == 0;
+                    slice.completesEpoch = epoch.filled + slice.numSamples >= epochLength;
+
+                    f(static_cast<const Slice&>(slice));
+
+                    epoch.filled += slice.numSamples;
+                }
+
+                // Epochs of a trigger normally complete in order of arrival. One that completes
+                // behind a longer-running one just keeps its slot until that one is done.
+                while (!open.isEmpty() && open.front().filled >= epochLength)
+                {
+                    open.pop();
+                }
+            }
+        }
+
+    private:
+        struct Epoch
+        {
+            int64_t start;
+            int64_t filled;
+        };
+
+        int numTriggers;
+        int64_t epochLength;
+
+        std::vector<EventRing<Epoch>> epochs; // open epochs, oldest first (trigger x epoch)
+    };
+}
+
+#endif // EPOCH_SCHEDULER_H_INCLUDED
@@ -0,0 +1,121 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef EVENT_RING_H_INCLUDED
+#define EVENT_RING_H_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+/*
+* Fixed-capacity FIFO ring for events (or anything else) queued and consumed on the audio
+* thread. Storage is allocated only by the constructor and setCapacity(), so push() and pop()
+* are O(1) and never touch the heap. Pushing onto a full ring drops the new element and counts
+* it, rather than growing or overwriting the oldest element (unlike CircularArray::enqueue).
+*
+* Elements stay at the same place in storage until they are popped, and getSlot() returns that
+* place, so it can be used to index per-element storage kept alongside the ring.
+*/
+
+template<typename T>
+class EventRing
+{
+public:
+    explicit EventRing(int capacity = 0)
+        : head          (0)
+        , count         (0)
+        , numDropped    (0)
+    {
+        setCapacity(capacity);
+    }
+
+    /** Allocates room for the given number of elements, removing all elements.
+        Not real-time safe. */
+    void setCapacity(int capacity)
+    {
+        storage.assign(capacity > 0 ? capacity : 0, T());
+        clear();
+    }
+
+    /** Removes all elements (keeps the dropped count) */
+    void clear()
+    {
+        head = 0;
+        count = 0;
+    }
+
+    /** Adds an element after the newest one. Returns false and counts a drop if full. */
+    bool push(const T& value)
+    {
+        if (isFull())
+        {
+            ++numDropped;
+            return false;
+        }
+
+        storage[getSlot(count)] = value;
+        ++count;
+        return true;
+    }
+
+    /** Removes the oldest element, if any */
+    void pop()
+    {
+        if (count > 0)
+        {
+            head = head + 1 == getCapacity() ? 0 : head + 1;
+            --count;
+        }
+    }
+
+    /** Element i, counting from the oldest (precondition: 0 <= i < size()) */
+    T& operator[](int i) { return storage[getSlot(i)]; }
+    const T& operator[](int i) const { return storage[getSlot(i)]; }
+
+    T& front() { return storage[head]; }
+    const T& front() const { return storage[head]; }
+
+    /** Index in [0, getCapacity()) where element i is stored */
+    int getSlot(int i) const
+    {
+        int slot = head + i;
+        return slot >= getCapacity() ? slot - getCapacity() : slot;
+    }
+
+    int size() const { return count; }
+    int getCapacity() const { return int(storage.size()); }
+    bool isEmpty() const { return count == 0; }
+    bool isFull() const { return count == getCapacity(); }
+
+    /** Number of elements that didn't fit since the last call to resetNumDropped() */
+    uint64_t getNumDropped() const { return numDropped; }
+    void resetNumDropped() { numDropped = 0; }
+
+private:
+    std::vector<T> storage;
+    int head; // slot of the oldest element
+    int count;
+    uint64_t numDropped;
+};
+
+#endif // EVENT_RING_H_INCLUDED
@@ -0,0 +1,106 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef LOCK_FREE_QUEUE_H_INCLUDED
+#define LOCK_FREE_QUEUE_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/*
+* Fixed-capacity FIFO queue for passing values from exactly one "producer" thread to exactly
+* one "consumer" thread. Both push() and pop() are wait-free and never allocate, so either end
+* can be used from the audio thread. All storage is allocated by the constructor.
+*
+* push() returns false (and drops the value) if the queue is full; pop() returns false if it
+* is empty. As with AtomicSynchronizer, the class doesn't check that there is only one
+* producer and one consumer; that's up to the user.
+*/
+
+template<typename T>
+class LockFreeQueue
+{
+public:
+    explicit LockFreeQueue(size_t capacity)
+        : buffer  (capacity + 1) // one slot stays empty to tell full from empty
+        , head    (0)
+        , tail    (0)
+    {}
+
+    LockFreeQueue(const LockFreeQueue&) = delete;
+    LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+    // should only be called by the producer
+    bool push(const T& value)
+    {
+        size_t currTail = tail.load(std::memory_order_relaxed);
+        size_t nextTail = increment(currTail);
+
+        if (nextTail == head.load(std::memory_order_acquire))
+        {
+            return false; // full
+        }
+
+        buffer[currTail] = value;
+        tail.store(nextTail, std::memory_order_release);
+        return true;
+    }
+
+    // should only be called by the consumer
+    bool pop(T& value)
+    {
+        size_t currHead = head.load(std::memory_order_relaxed);
+
+        if (currHead == tail.load(std::memory_order_acquire))
+        {
+            return false; // empty
+        }
+
+        value = buffer[currHead];
+        head.store(increment(currHead), std::memory_order_release);
+        return true;
+    }
+
+    bool isEmpty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    size_t getCapacity() const
+    {
+        return buffer.size() - 1;
+    }
+
+private:
+    size_t increment(size_t index) const
+    {
+        return index + 1 == buffer.size() ? 0 : index + 1;
+    }
+
+    std::vector<T> buffer;
+    std::atomic<size_t> head; // next index to pop; written by the consumer
+    std::atomic<size_t> tail; // next index to push; written by the producer
+};
+
+#endif // LOCK_FREE_QUEUE_H_INCLUDED
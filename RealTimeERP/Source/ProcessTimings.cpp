@@ -0,0 +1,206 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ProcessTimings.h"
+
+#include <cstdio>
+
+using namespace RealTimeERP;
+
+/*********** Histogram ***********/
+
+ProcessTimings::Histogram::Histogram()
+{
+    reset();
+}
+
+void ProcessTimings::Histogram::reset()
+{
+    for (int b = 0; b < numBuckets; ++b)
+    {
+        counts[b].store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+int ProcessTimings::Histogram::getBucket(uint64_t value)
+{
+    if (value < 8)
+    {
+        return int(value);
+    }
+
+    // position of the highest set bit
+    int exponent = 0;
+    for (int shift = 32; shift > 0; shift >>= 1)
+    {
+        if (value >> (exponent + shift) != 0)
+        {
+            exponent += shift;
+        }
+    }
+
+    // and the two bits below it
+    int quarter = int(value >> (exponent - 2)) & 3;
+    return 8 + (exponent - 3) * 4 + quarter;
+}
+
+uint64_t ProcessTimings::Histogram::getBucketStart(int bucket)
+{
+    if (bucket < 8)
+    {
+        return uint64_t(bucket);
+    }
+    int exponent = (bucket - 8) / 4 + 3;
+    int quarter = (bucket - 8) % 4;
+    return uint64_t(4 + quarter) << (exponent - 2);
+}
+
+uint64_t ProcessTimings::Histogram::getNumValues() const
+{
+    uint64_t n = 0;
+    for (int b = 0; b < numBuckets; ++b)
+    {
+        n += getCount(b);
+    }
+    return n;
+}
+
+double ProcessTimings::Histogram::getMean() const
+{
+    uint64_t n = getNumValues();
+    return n > 0 ? double(total.load(std::memory_order_relaxed)) / n : 0.0;
+}
+
+uint64_t ProcessTimings::Histogram::getPercentile(double percentile) const
+{
+    uint64_t n = getNumValues();
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = uint64_t(percentile / 100 * (n - 1));
+    uint64_t seen = 0;
+    for (int b = 0; b < numBuckets; ++b)
+    {
+        seen += getCount(b);
+        if (seen > rank)
+        {
+            return getBucketStart(b);
+        }
+    }
+    return getMax();
+}
+
+/*********** ProcessTimings ***********/
+
+void ProcessTimings::reset()
+{
+    for (Histogram& histogram : histograms)
+    {
+        histogram.reset();
+    }
+}
+
+const char* ProcessTimings::getName(Metric metric)
+{
+    switch (metric)
+    {
+    case EVENT_HANDLING:  return "event handling";
+    case EPOCH_FOLD:      return "epoch fold";
+    case STATISTICS:      return "statistics";
+    case PUBLISH:         return "publish";
+    case BLOCK:           return "whole block";
+    case BLOCK_LOAD:      return "block load";
+    case OPEN_EPOCHS:     return "open epochs";
+    case COMMAND_BACKLOG: return "command backlog";
+    case BLOCK_EVENTS:    return "events per block";
+    default:              return "";
+    }
+}
+
+const char* ProcessTimings::getUnit(Metric metric)
+{
+    switch (metric)
+    {
+    case EVENT_HANDLING:
+    case EPOCH_FOLD:
+    case STATISTICS:
+    case PUBLISH:
+    case BLOCK:
+        return "ns";
+
+    case BLOCK_LOAD:
+        return "%";
+
+    default:
+        return "";
+    }
+}
+
+void ProcessTimings::writeSummary(std::ostream& out) const
+{
+    char line[256];
+    for (int m = 0; m < NUM_METRICS; ++m)
+    {
+        const Histogram& h = histograms[m];
+        if (h.getNumValues() == 0)
+        {
+            continue;
+        }
+        std::snprintf(line, sizeof(line), "%-17s %-3s n %-9llu mean %-10.1f p50 %-9llu p99 %-9llu p99.9 %-9llu max %llu\n",
+            getName(Metric(m)), getUnit(Metric(m)), (unsigned long long)h.getNumValues(), h.getMean(),
+            (unsigned long long)h.getPercentile(50), (unsigned long long)h.getPercentile(99),
+            (unsigned long long)h.getPercentile(99.9), (unsigned long long)h.getMax());
+        out << line;
+    }
+}
+
+void ProcessTimings::dump(std::ostream& out) const
+{
+    out << "metric,unit,count,mean,p50,p90,p99,p99.9,max\n";
+    for (int m = 0; m < NUM_METRICS; ++m)
+    {
+        const Histogram& h = histograms[m];
+        out << getName(Metric(m)) << ',' << getUnit(Metric(m)) << ',' << h.getNumValues() << ','
+            << h.getMean() << ',' << h.getPercentile(50) << ',' << h.getPercentile(90) << ','
+            << h.getPercentile(99) << ',' << h.getPercentile(99.9) << ',' << h.getMax() << '\n';
+    }
+
+    out << "\nmetric,unit,bucket_start,bucket_end,count\n";
+    for (int m = 0; m < NUM_METRICS; ++m)
+    {
+        const Histogram& h = histograms[m];
+        for (int b = 0; b < Histogram::numBuckets; ++b)
+        {
+            uint64_t count = h.getCount(b);
+            if (count > 0)
+            {
+                out << getName(Metric(m)) << ',' << getUnit(Metric(m)) << ',' << Histogram::getBucketStart(b) << ','
+                    << (b + 1 < Histogram::numBuckets ? Histogram::getBucketStart(b + 1) : UINT64_MAX) << ',' << count << '\n';
+            }
+        }
+    }
+}
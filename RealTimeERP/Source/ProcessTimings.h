@@ -0,0 +1,144 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef PROCESS_TIMINGS_H_INCLUDED
+#define PROCESS_TIMINGS_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+/*
+* Lock-free timing instrumentation of the audio thread, cheap enough to leave on: each block
+* costs a handful of clock reads and histogram increments, and nothing allocates or locks.
+*
+* Every metric (a phase of process(), the block's share of its real-time budget, or a count
+* such as open epochs) goes into a fixed-bucket Histogram. Buckets are exact up to 7, then
+* there are 4 per power of 2 (so any value is within 25% of its bucket's lower bound), which
+* covers everything from single nanoseconds to minutes in a few hundred counters.
+*
+* One thread adds values; any thread can read them (relaxed atomics, so a reader can see a
+* block half recorded, which doesn't matter for statistics). reset() must only be called
+* while nothing is adding, e.g. before acquisition starts.
+*/
+
+namespace RealTimeERP
+{
+    class ProcessTimings
+    {
+    public:
+        class Histogram
+        {
+        public:
+            static const int numBuckets = 252; // up to 2^64
+
+            Histogram();
+
+            /** Single writer only */
+            void add(uint64_t value)
+            {
+                increment(counts[getBucket(value)], 1);
+                increment(total, value);
+                if (value > max.load(std::memory_order_relaxed))
+                {
+                    max.store(value, std::memory_order_relaxed);
+                }
+            }
+
+            void reset();
+
+            uint64_t getCount(int bucket) const { return counts[bucket].load(std::memory_order_relaxed); }
+            uint64_t getNumValues() const;
+            uint64_t getMax() const { return max.load(std::memory_order_relaxed); }
+            double getMean() const;
+
+            /** Lower bound of the bucket holding the given percentile (0-100) of the values */
+            uint64_t getPercentile(double percentile) const;
+
+            static int getBucket(uint64_t value);
+            static uint64_t getBucketStart(int bucket);
+
+        private:
+            static void increment(std::atomic<uint64_t>& x, uint64_t amount)
+            {
+                // (only one thread writes, so no read-modify-write needed)
+                x.store(x.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+            }
+
+            std::atomic<uint64_t> counts[numBuckets];
+            std::atomic<uint64_t> total;
+            std::atomic<uint64_t> max;
+        };
+
+        enum Metric
+        {
+            EVENT_HANDLING = 0, // ns spent in checkForEvents/handleEvent
+            EPOCH_FOLD,         // ns spent adding block samples to the open epochs
+            STATISTICS,         // ns spent finishing slices, completed epochs' statistics and envelopes
+            PUBLISH,            // ns spent copying the averages to the visualizer
+            BLOCK,              // ns spent in process() as a whole
+            BLOCK_LOAD,         // process() time as a percentage of the block's duration
+            OPEN_EPOCHS,        // open epochs (all triggers) after the block
+            COMMAND_BACKLOG,    // control commands waiting at the start of the block
+            BLOCK_EVENTS,       // events received in the block
+            NUM_METRICS
+        };
+
+        /** Monotonic time in ns, for add()ing differences */
+        static int64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void add(Metric metric, uint64_t value) { histograms[metric].add(value); }
+
+        /** Adds the time since start (from now()) and returns the current time */
+        int64_t addTimeSince(Metric metric, int64_t start)
+        {
+            int64_t end = now();
+            histograms[metric].add(uint64_t(std::max<int64_t>(0, end - start)));
+            return end;
+        }
+
+        const Histogram& get(Metric metric) const { return histograms[metric]; }
+
+        void reset();
+
+        static const char* getName(Metric metric);
+        static const char* getUnit(Metric metric);
+
+        /** One line per metric that has values, with its count, mean, percentiles and max */
+        void writeSummary(std::ostream& out) const;
+
+        /** The summary followed by every non-empty bucket of every metric, as CSV */
+        void dump(std::ostream& out) const;
+
+    private:
+        Histogram histograms[NUM_METRICS];
+    };
+}
+
+#endif // PROCESS_TIMINGS_H_INCLUDED
@@ -27,23 +27,36 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "RealTimeERP.h"
 #include "RealTimeERPEditor.h"
 
+#include <sstream>
+
 using namespace RealTimeERP;
 
+// Latest a TTL can arrive after its timestamp and still get its whole pre-trigger window
+static const float maxEventLatencySec = 0.05f;
+
 Node::Node()
     : GenericProcessor("Real Time ERP")
     , triggerChannels   ({})
     //, ttlTimestampBuffer({})
     , ERPLenSec         (1.0)
     , alpha             (0)
-    , curLFP            ({})
-    , curSamp           ({})
-    , resetBuffer       (false)
+    , window            (0)
+    , robust            (false)
+    , quantile          (0.5f)
+    , controlQueue      (64)
+    , acquisitionActive (false)
+    , logDrainer        (rtLog)
+    , preLenSec         (0)
+    , preLenSamps       (0)
+    , blockEvents       (0)
+    , archiveDropped    (0)
     //, avgLFP            ({})//(0, vector<vector<RWA>>(0, vector<RWA>(0)))
     //, avgSum            ({})//(0,vector<RWA>(0))
     //, avgPeak           ({})//(0, vector<RWA>(0, RWA(0)))
     //, avgTimeToPeak     ({})//(0, vector<RWA>(0,RWA(0)))
 {
     setProcessorType(PROCESSOR_TYPE_SINK);
+    engine.setTimings(&timings);
 }
 
 Node::~Node() {}
@@ -58,48 +71,36 @@ void Node::updateSettings()
 {
     // Things got updated, reset vector sizes based on new data
     fs = GenericProcessor::getSampleRate();
-    ERPLenSamps = fs * ERPLenSec;
+    preLenSamps = int(fs * preLenSec);
+    ERPLenSamps = fs * ERPLenSec + preLenSamps;
 
     activeChannels = getActiveInputs();
     numChannels = activeChannels.size();
 
     int numTriggers = triggerChannels.size();
 
-    // Init ttlTimestampBuffer to empty deques
-    ttlTimestampBuffer = std::vector<std::vector<int64>>(numTriggers, std::vector<int64>(5));
-    
-    //std::fill(ttlTimestampBuffer.begin(), ttlTimestampBuffer.end(), std::vector<int64>(5));
-    for (int i = 0; i < numTriggers; i++)
+    // No open epochs, empty averages (without channels, they stay that way: process() then
+    // skips the blocks instead of resetting the engine for each one)
+    double waveformQuantile = robust ? quantile : -1;
+    engine.configure(numTriggers, numChannels, int(ERPLenSamps), preLenSamps,
+        int(fs * maxEventLatencySec), alpha, waveformQuantile, window);
+    blockChannels.resize(numChannels);
+
+    // The window's epochs may not have fit in memory
+    if (engine.getWindow() != window)
     {
-        ttlTimestampBuffer[i].clear();
+        String message = "Real Time ERP: not enough memory to keep the last " + String(window) + " epochs, "
+            + (engine.getWindow() > 0 ? "averaging the last " + String(engine.getWindow()) + " instead" : "window turned off");
+        std::cout << message << std::endl;
+        CoreServices::sendStatusMessage(message);
+        window = engine.getWindow();
     }
 
-    // Make a new audio sample buffer for each ttl trigger
-    curLFP = std::vector<AudioSampleBuffer>(numTriggers, AudioSampleBuffer(numChannels, ERPLenSamps));
-    curSamp = std::vector<uint64>(numTriggers, 0);
-    
-    localAvgLFP = vector<vector<vector<RWA>>>(numTriggers, vector<vector<RWA>>(numChannels, vector<RWA>(ERPLenSamps, RWA(alpha))));
-    avgLFP.map([=](vector<vector<vector<RWA>>>& vec)
-        {
-            vec = vector<vector<vector<RWA>>>(numTriggers, vector<vector<RWA>>(numChannels, vector<RWA>(ERPLenSamps, RWA(alpha))));
-        });
-
-    localAvgSum = vector<vector<RWA>>(numTriggers, vector<RWA>(numChannels, RWA(alpha)));
-    avgSum.map([=](vector<vector<RWA>>& vec)
-        {
-            vec = vector<vector<RWA>>(numTriggers, vector<RWA>(numChannels, RWA(alpha)));
-        });
-
-    localAvgPeak = vector<vector<RWA>>(numTriggers, vector<RWA>(numChannels, RWA(alpha)));
-    avgPeak.map([=](vector<vector<RWA>>& vec)
+    avgSnapshot.map([=](ERPSnapshot& snapshot)
         {
-            vec = vector<vector<RWA>>(numTriggers, vector<RWA>(numChannels, RWA(alpha)));
-        });
-
-    localAvgTimeToPeak = vector<vector<RWA>>(numTriggers, vector<RWA>(numChannels, RWA(alpha)));
-    avgTimeToPeak.map([=](vector<vector<RWA>>& vec)
-        {
-            vec = vector<vector<RWA>>(numTriggers, vector<RWA>(numChannels, RWA(alpha)));
+            // (without the window's epochs, which only the engine needs; the first update
+            // copies the window length over)
+            snapshot.resize(numTriggers, numChannels, int(ERPLenSamps), alpha, waveformQuantile);
         });
 
     // Populate Event sources
@@ -125,127 +126,138 @@ void Node::updateSettings()
     }
 }
 
-void Node::process(AudioSampleBuffer& buffer)
+bool Node::enable()
 {
-	checkForEvents(false); // Check for ttl events
-    AtomicScopedWritePtr<vector<vector<RWA>>> sumWriter(avgSum); 
-    AtomicScopedWritePtr<vector<vector<vector<RWA>>>> LFPWriter(avgLFP);
-    AtomicScopedWritePtr<vector<vector<RWA>>> peakWriter(avgPeak);
-    AtomicScopedWritePtr<vector<vector<RWA>>> ttPeakWriter(avgTimeToPeak);
-    if (!sumWriter.isValid() && !LFPWriter.isValid() && !peakWriter.isValid() && !peakWriter.isValid())
+    // process() isn't running yet, so nothing can be left half done
+    applyPendingCommands();
+    acquisitionActive = true;
+
+    rtLog.resetCounters();
+    timings.reset();
+    logDrainer.startTimer(250);
+
+    // Spread the per-channel work of high channel count probes over a few threads
+    engine.startWorkers();
+
+    // Epochs left open by the last acquisition would wait for their timestamps forever
+    // if the new one starts over from 0
+    engine.clearOpenEpochs();
+
+    openArchive();
+
+    return GenericProcessor::enable();
+}
+
+bool Node::disable()
+{
+    acquisitionActive = false;
+
+    logDrainer.stopTimer();
+    rtLog.drain(std::cout);
+    std::cout << "Real Time ERP: " << rtLog.getCount(RealTimeLog::EVENTS_RECEIVED) << " events received, "
+        << rtLog.getCount(RealTimeLog::EPOCHS_COMPLETED) << " epochs completed, "
+        << rtLog.getCount(RealTimeLog::EVENTS_DROPPED) << " events dropped" << std::endl;
+
+    for (int t = 0; t < engine.getNumTriggers(); ++t)
     {
-        std::cout << "Not valid writers" << std::endl;
-        jassertfalse; // atomic sync data writer broken
+        uint64 dropped = engine.getNumDroppedEvents(t);
+        if (dropped > 0)
+        {
+            std::cout << "Real Time ERP: dropped " << dropped << " events of " << triggerChannels[t].name
+                << " (too many overlapping epochs)" << std::endl;
+        }
+    }
+
+    std::ostringstream summary;
+    timings.writeSummary(summary);
+    std::cout << "Real Time ERP: timings\n" << summary.str() << std::flush;
+
+    engine.stopWorkers();
+
+    closeArchive();
+
+    if (applyPendingCommands() > 0)
+    {
+        publishAverages();
     }
-    // If new TTL timestamp to handle (stim happened), timestamp is removed once calculation is complete
-    ScopedLock resetLock(onlineReset);
-    for (int t = 0; t < triggerChannels.size(); t++)
+    return GenericProcessor::disable();
+}
+
+void Node::process(AudioSampleBuffer& buffer)
+{
+    int64 blockStart = ProcessTimings::now();
+
+    // Resets etc. happen between blocks, so no epoch is ever half reset
+    int numCommands = applyPendingCommands();
+    bool changed = numCommands > 0;
+    timings.add(ProcessTimings::COMMAND_BACKLOG, numCommands);
+
+    // Make sure we have input (without it, there are no epochs for the events to open)
+    if (numChannels <= 0)
     {
-        if (!ttlTimestampBuffer[t].empty())
+        if (changed)
         {
-            // Make sure we have input
-            if (numChannels <= 0)
-            {
-                ttlTimestampBuffer[t].erase(ttlTimestampBuffer[t].begin());
-                jassertfalse;
-                return;
-            }
+            publishAverages();
+        }
+        return;
+    }
 
-            // Get timestamp of trigger 
-            uint64 stimTime = ttlTimestampBuffer[t].front();
-            uint64 nBufSamps = getNumSamples(activeChannels[0]);
-            uint64 bufTimestamp = getTimestamp(activeChannels[0]);
-            // 0/110 for 
-            uint64 networkTS = getSourceTimestamp(110, 0);
-            uint64 curBufStartSamp = 0; // Middle buffers use all ...
-            uint64 curBufEndSamp = nBufSamps; // samples in buffer
-            bool done = false;
-            // first buffer, starts at stim, ends at end of buffer
-            if (stimTime > bufTimestamp || (stimTime < bufTimestamp && curSamp[t] == 0)) 
-            {
-                if (stimTime > bufTimestamp)
-                {
-                    curBufStartSamp = stimTime - bufTimestamp;
-                }
-                else
-                {
-                    ttlTimestampBuffer[t][0] = bufTimestamp;
-                }
-                curSamp[t] = 0; // Start at beginning for the saved buffer, new data
-            }
-            
-            // last buffer, starts at 0, ends in middle of buffer
-            else if (stimTime + ERPLenSamps < bufTimestamp + nBufSamps) 
-            {
-                curBufEndSamp = stimTime + ERPLenSamps - bufTimestamp;
-                ttlTimestampBuffer[t].erase(ttlTimestampBuffer[t].begin());
-                done = true;
-            }
-            uint64 curNSamps = curBufEndSamp - curBufStartSamp;
-            // Loop through each channel and fill current audio buffer
-            for (int n = 0; n < numChannels; n++)
-            {  
-                int chan = activeChannels[n];
-                curLFP[t].copyFrom(n, curSamp[t], buffer, chan, curBufStartSamp, curNSamps);
-
-                // Buffer filled, compute!
-                // Thread this? Can't imagine it's too difficult to compute though?
-                if (done)
-                {
-                    // Get read pointer for curLFP
-                    const float* rpIn = curLFP[t].getReadPointer(n);
-                    
-                    // Get our peak and sum by looping through buffer
-                    double curSum = 0;
-                    double curPeak = 0;
-                    uint64 curTimeToPeak = 0;
-                    for (uint64 samp = 0; samp < ERPLenSamps; samp++)
-                    {
-                        curSum += abs(rpIn[samp]);
-                        localAvgLFP[t][n][samp].addValue(rpIn[samp]);
-                        // Probably don't want the entire ERPLen samps for peak hmmm
-                        // Need to look at if this correct.
-                        if (curPeak <= abs(rpIn[samp])) 
-                        {
-                            curPeak = abs(rpIn[samp]);
-                            curTimeToPeak = samp;
-                        }
-                    }
+    int64 eventStart = ProcessTimings::now();
+    blockEvents = 0;
+	checkForEvents(false); // Check for ttl events
+    timings.addTimeSince(ProcessTimings::EVENT_HANDLING, eventStart);
+    timings.add(ProcessTimings::BLOCK_EVENTS, blockEvents);
 
-                    // Update values
-                    localAvgSum[t][n].addValue(curSum);
-                    
-                    localAvgPeak[t][n].addValue(curPeak);
-                    localAvgTimeToPeak[t][n].addValue(curTimeToPeak);
-                }
-            }
-            if (!done)
-            {
-                curSamp[t] += curNSamps; // Keep track of where we are in our saved buffer
-            }
-            else
-            {
-                // Send to Vis!
+    int nBufSamps = getNumSamples(activeChannels[0]);
+    int64 bufTimestamp = getTimestamp(activeChannels[0]);
 
-                sumWriter->assign(localAvgSum.begin(), localAvgSum.end());
-                peakWriter->assign(localAvgPeak.begin(), localAvgPeak.end());
-                ttPeakWriter->assign(localAvgTimeToPeak.begin(), localAvgTimeToPeak.end());
-                LFPWriter->assign(localAvgLFP.begin(), localAvgLFP.end());
+    for (int n = 0; n < numChannels; n++)
+    {
+        blockChannels[n] = buffer.getReadPointer(activeChannels[n]);
+    }
 
-                LFPWriter.pushUpdate();
-                sumWriter.pushUpdate();
-                peakWriter.pushUpdate();
-                ttPeakWriter.pushUpdate();
-                std::cout << "Pushed update!" << std::endl;
+    // Fold this buffer into every open epoch (there can be several per trigger)
+    int numCompleted = engine.processBlock(blockChannels.data(), nBufSamps, bufTimestamp);
+    rtLog.increment(RealTimeLog::EPOCHS_COMPLETED, numCompleted);
+    timings.add(ProcessTimings::OPEN_EPOCHS, engine.getNumOpenEpochs());
 
-                curSamp[t] = 0;
-                if (resetBuffer)
-                {
-                    resetVectors();
-                }
-            }
-        }
-    }  
+    // Say so while recording if epochs miss the archive (only when its buffers are limited)
+    if (archive.isOpen() && archive.getNumDropped() != archiveDropped)
+    {
+        rtLog.log(RealTimeLog::LOG_WARNING, "Out of archive buffers, epochs not archived so far:", 1, archive.getNumDropped());
+        archiveDropped = archive.getNumDropped();
+    }
+
+    if (numCompleted > 0 || changed)
+    {
+        int64 publishStart = ProcessTimings::now();
+        publishAverages();
+        timings.addTimeSince(ProcessTimings::PUBLISH, publishStart);
+    }
+
+    // How much of the time this block represents it took to process
+    int64 blockNs = timings.addTimeSince(ProcessTimings::BLOCK, blockStart) - blockStart;
+    if (nBufSamps > 0 && fs > 0)
+    {
+        timings.add(ProcessTimings::BLOCK_LOAD, uint64(blockNs * 100 / (1e9 * nBufSamps / fs)));
+    }
+}
+
+void Node::publishAverages()
+{
+    AtomicScopedWritePtr<ERPSnapshot> avgWriter(avgSnapshot);
+    if (!avgWriter.isValid())
+    {
+        rtLog.log(RealTimeLog::LOG_ERROR, "Not valid writers");
+        jassertfalse; // atomic sync data writer broken
+        return;
+    }
+
+    // Send to Vis! (only triggers that changed since this slot was last written get copied,
+    // with the envelope of epochs still being folded too, e.g. after a command)
+    engine.updateEnvelope();
+    avgWriter->copyChangedFrom(engine.getAverages());
+    avgWriter.pushUpdate();
 }
 
 void Node::handleEvent(const EventChannel* eventInfo, const MidiMessage& event, int sampleNum)
@@ -264,8 +276,16 @@ void Node::handleEvent(const EventChannel* eventInfo, const MidiMessage& event,
                 TTLEventPtr ttl = TTLEvent::deserializeFromMessage(event, eventInfo);
                 if (ttl->getChannel() == triggerChannels[n].channel && ttl->getState())
                 {
-                    std::cout << "Got an event from " << ttl->getChannel() << std::endl;
-                    ttlTimestampBuffer[n].push_back(Event::getTimestamp(event)); // add timestamp of TTL to buffer
+                    rtLog.increment(RealTimeLog::EVENTS_RECEIVED);
+                    ++blockEvents;
+                    rtLog.log(RealTimeLog::LOG_DEBUG, "Got an event from", 1, ttl->getChannel());
+
+                    // open an epoch at the TTL timestamp
+                    if (!engine.addEvent(n, Event::getTimestamp(event)))
+                    {
+                        rtLog.increment(RealTimeLog::EVENTS_DROPPED);
+                        rtLog.log(RealTimeLog::LOG_WARNING, "Too many overlapping epochs, dropped an event of trigger", 1, n + 1);
+                    }
                 }
             }
         }
@@ -274,26 +294,22 @@ void Node::handleEvent(const EventChannel* eventInfo, const MidiMessage& event,
 
 void Node::resetVectors()
 {
-    int numTriggers = triggerChannels.size();
-    for (int trig = 0; trig < numTriggers; trig++)
-    {
-        for (int chan = 0; chan < numChannels; chan++)
-        {
-            localAvgSum[trig][chan].reset();
-            localAvgPeak[trig][chan].reset();
-            localAvgTimeToPeak[trig][chan].reset();
-            for (int samp = 0; samp < ERPLenSamps; samp++)
-            {
-                localAvgLFP[trig][chan][samp].reset();
-            }
-        }
-    }
+    engine.reset();
 }
 
 void Node::visResetVectors()
 {
-    ScopedLock resetLock(onlineReset);
-    resetVectors();
+    ControlCommand command;
+    command.type = ControlCommand::RESET_ALL;
+    sendCommand(command);
+}
+
+void Node::visResetTrigger(int trigger)
+{
+    ControlCommand command;
+    command.type = ControlCommand::RESET_TRIGGER;
+    command.trigger = trigger;
+    sendCommand(command);
 }
 
 void Node::setInstOrAvg(bool instOrAvg)
@@ -302,12 +318,167 @@ void Node::setInstOrAvg(bool instOrAvg)
     Sending a 1 has the plugin only show data for the most recent Event.
 */
 {
-    ScopedLock resetLock(onlineReset);
-    resetBuffer = instOrAvg ? true : false;
-    if (resetBuffer)
+    ControlCommand command;
+    command.type = ControlCommand::SET_INSTANTANEOUS;
+    command.instantaneous = instOrAvg;
+    sendCommand(command);
+}
+
+void Node::sendCommand(const ControlCommand& command)
+{
+    if (!acquisitionActive)
+    {
+        // Nothing else is touching the averages
+        applyCommand(command);
+        publishAverages();
+    }
+    else if (!controlQueue.push(command))
+    {
+        std::cout << "Real Time ERP: too many pending commands, ignoring one" << std::endl;
+    }
+}
+
+int Node::applyPendingCommands()
+{
+    int numApplied = 0;
+    ControlCommand command;
+    while (controlQueue.pop(command))
+    {
+        applyCommand(command);
+        ++numApplied;
+    }
+    return numApplied;
+}
+
+bool Node::dumpTimings(const File& file) const
+{
+    std::ostringstream csv;
+    timings.dump(csv);
+    return file.replaceWithText(String(csv.str()));
+}
+
+void Node::applyCommand(const ControlCommand& command)
+{
+    switch (command.type)
     {
+    case ControlCommand::RESET_ALL:
         resetVectors();
-    } 
+        break;
+
+    case ControlCommand::RESET_TRIGGER:
+        engine.resetTrigger(command.trigger);
+        break;
+
+    case ControlCommand::SET_INSTANTANEOUS:
+        // Either way the averages start over, so that the last N epochs and their sum agree
+        engine.setReplace(command.instantaneous);
+        resetVectors();
+        break;
+    }
+}
+
+void Node::openArchive()
+{
+    if (archiveDirectory.getFullPathName().isEmpty())
+    {
+        return;
+    }
+
+    File archiveFile = archiveDirectory.getChildFile("epochs_"
+        + Time::getCurrentTime().formatted("%Y-%m-%d_%H-%M-%S") + ".erp");
+
+    std::vector<int> channels(numChannels);
+    for (int n = 0; n < numChannels; n++)
+    {
+        channels[n] = activeChannels[n];
+    }
+
+    archiveDropped = 0;
+    if (archive.open(archiveFile.getFullPathName().toStdString(), triggerChannels.size(), channels,
+        int(ERPLenSamps), preLenSamps, fs, engine.getMaxOpenEpochs()) && engine.setArchive(&archive))
+    {
+        std::cout << "Real Time ERP: archiving epochs to " << archiveFile.getFullPathName() << std::endl;
+        if (archive.isBufferLimited())
+        {
+            // Each open epoch holds a buffer, and they don't all fit in memory
+            String message = "Real Time ERP: the archive only has room for " + String(archive.getNumBuffers())
+                + " epochs at a time (of " + String(engine.getMaxOpenEpochs()) + " that can be open); "
+                + "if more overlap, some won't be archived";
+            std::cout << message << std::endl;
+            CoreServices::sendStatusMessage(message);
+        }
+    }
+    else
+    {
+        archive.close();
+        CoreServices::sendStatusMessage("Real Time ERP: couldn't create " + archiveFile.getFullPathName());
+    }
+}
+
+void Node::closeArchive()
+{
+    if (!archive.isOpen())
+    {
+        return;
+    }
+
+    // Writes whatever is still queued
+    engine.setArchive(nullptr);
+    archive.close();
+    std::cout << "Real Time ERP: archived " << archive.getNumWritten() << " epochs ("
+        << archive.getNumDropped() << " couldn't be archived)" << std::endl;
+}
+
+bool Node::replayArchive(const File& file)
+{
+    if (acquisitionActive)
+    {
+        return false;
+    }
+
+    EpochArchiveReader reader;
+    if (!reader.open(file.getFullPathName().toStdString()))
+    {
+        CoreServices::sendStatusMessage("Real Time ERP: " + file.getFileName() + " isn't an epoch archive");
+        return false;
+    }
+
+    // Archived channels go to the active channels with the same number, triggers by index
+    std::vector<int> channelMap(numChannels, -1);
+    for (int n = 0; n < numChannels; n++)
+    {
+        for (int a = 0; a < reader.getNumChannels(); a++)
+        {
+            if (reader.getChannel(a) == activeChannels[n])
+            {
+                channelMap[n] = a;
+            }
+        }
+    }
+
+    if (reader.getSampleRate() != fs)
+    {
+        std::cout << "Real Time ERP: " << file.getFileName() << " was recorded at " << reader.getSampleRate()
+            << " Hz, not " << fs << " Hz" << std::endl;
+    }
+
+    int64 start = ProcessTimings::now();
+    engine.startWorkers();
+    bool replayed = engine.replay(reader, channelMap);
+    engine.stopWorkers();
+
+    if (!replayed)
+    {
+        CoreServices::sendStatusMessage("Real Time ERP: the epochs in " + file.getFileName()
+            + " are shorter than the current window");
+        return false;
+    }
+
+    publishAverages();
+    std::cout << "Real Time ERP: replayed " << engine.getAverages().totalEpochs << " epochs of "
+        << file.getFileName() << " in " << (ProcessTimings::now() - start) / 1e9 << " s" << std::endl;
+    CoreServices::sendStatusMessage("Real Time ERP: replayed " + String(engine.getAverages().totalEpochs) + " epochs");
+    return true;
 }
 
 Array<int> Node::getActiveInputs()
@@ -338,6 +509,26 @@ void Node::setParameter(int parameterIndex, float newValue)
         ERPLenSec = newValue;
         updateSettings();
     }
+    else if (parameterIndex == PRE_LEN)
+    {
+        preLenSec = newValue;
+        updateSettings();
+    }
+    else if (parameterIndex == ROBUST)
+    {
+        robust = newValue != 0;
+        updateSettings();
+    }
+    else if (parameterIndex == QUANTILE)
+    {
+        quantile = newValue;
+        updateSettings();
+    }
+    else if (parameterIndex == WINDOW)
+    {
+        window = int(newValue);
+        updateSettings();
+    }
 }
 
 void Node::saveCustomParametersToXml(XmlElement* parentElement)
@@ -356,7 +547,12 @@ void Node::saveCustomParametersToXml(XmlElement* parentElement)
 
     // ------ Save Other Params ------ //
     mainNode->setAttribute("alpha", alpha);
+    mainNode->setAttribute("Window", window);
     mainNode->setAttribute("ERPLen", ERPLenSec);
+    mainNode->setAttribute("PreLen", preLenSec);
+    mainNode->setAttribute("Robust", robust);
+    mainNode->setAttribute("Quantile", quantile);
+    mainNode->setAttribute("ArchiveDirectory", archiveDirectory.getFullPathName());
 }
 
 void Node::loadCustomParametersFromXml()
@@ -385,7 +581,13 @@ void Node::loadCustomParametersFromXml()
             }
             // Load other params
             alpha = mainNode->getDoubleAttribute("alpha");
+            window = mainNode->getIntAttribute("Window", 0);
             ERPLenSec = mainNode->getDoubleAttribute("ERPLen");
+            preLenSec = mainNode->getDoubleAttribute("PreLen", 0);
+            robust = mainNode->getBoolAttribute("Robust", false);
+            quantile = mainNode->getDoubleAttribute("Quantile", 0.5);
+            String archivePath = mainNode->getStringAttribute("ArchiveDirectory");
+            archiveDirectory = archivePath.isEmpty() ? File() : File(archivePath);
         }
     }
     editor->update();
@@ -8,46 +8,14 @@
 #include <vector>
 
 #include "AtomicSynchronizer.h"
-#include "CircularArray.h"
+#include "ERPEngine.h"
+#include "LockFreeQueue.h"
+#include "ProcessTimings.h"
+#include "RealTimeLog.h"
 
 //namespace must be an unique name for your plugin
 namespace RealTimeERP
 {
-    struct RealWeightedAccum
-    {
-        RealWeightedAccum(double alpha = 0)
-            : count(0.0)
-            , sum(0)
-            , alpha(alpha)
-        {}
-
-        double getAverage() const
-        {
-            //std::cout << " GET AVG SUM " << sum << " and COUNT " << count << std::endl;
-            return count > 0 ? sum / (double)count : double();
-        }
-
-        void addValue(double x)
-        {
-            sum = x + (1 - alpha) * sum;
-            count = 1 + (1 - alpha) * count;
-            //std::cout << "SUM " << sum << " and COUNT " << count << std::endl;
-        }
-
-        void reset()
-        {
-            sum = 0;
-            count = 0.0;
-        }
-
-    private:
-        double sum;
-        size_t count;
-
-        double alpha;
-    };
-    using RWA = RealWeightedAccum;
-
     struct EventSources
     {
         unsigned int eventIndex;
@@ -138,6 +106,10 @@ namespace RealTimeERP
 		*/
 		void updateSettings() override;
 
+		/** Called when acquisition starts/stops */
+		bool enable() override;
+		bool disable() override;
+
         Array<int> Node::getActiveInputs();
 
     private:
@@ -147,29 +119,85 @@ namespace RealTimeERP
 
         void resetVectors();
         void visResetVectors();
+        void visResetTrigger(int trigger);
         void setInstOrAvg(bool instOrAvg);
-        bool resetBuffer;
+
+        // Requests from the visualizer, carried out by process() between blocks
+        struct ControlCommand
+        {
+            enum Type
+            {
+                RESET_ALL,
+                RESET_TRIGGER,
+                SET_INSTANTANEOUS
+            };
+
+            Type type;
+            int trigger; // RESET_TRIGGER
+            bool instantaneous; // SET_INSTANTANEOUS
+        };
+
+        // Carries out a command now if acquisition is stopped, or queues it for process()
+        void sendCommand(const ControlCommand& command);
+        void applyCommand(const ControlCommand& command);
+        // Applies all queued commands; returns how many there were
+        int applyPendingCommands();
+        // Copies local averages to the visualizer
+        void publishAverages();
+
+        LockFreeQueue<ControlCommand> controlQueue; // message thread -> process()
+        bool acquisitionActive; // only touched on the message thread
+
+        // Prints the real-time log on the message thread
+        class LogDrainer : public Timer
+        {
+        public:
+            LogDrainer(RealTimeLog& l) : log(l) {}
+            void timerCallback() override { log.drain(std::cout); }
+
+        private:
+            RealTimeLog& log;
+        };
+
+        RealTimeLog rtLog; // use instead of std::cout in process() and handleEvent()
+        LogDrainer logDrainer;
 
         //Array<int> triggerChannels;
-        vector<vector<int64>> ttlTimestampBuffer;
+        ERPEngine engine; // epoching and running averages for each trigger
+
+        vector<const float*> blockChannels; // read pointers of the active channels (reserved up front)
+
+        // Time spent in each phase of process() etc., for the visualizer's diagnostics panel
+        ProcessTimings timings;
+        int blockEvents; // events received in the current block
+
+        // Writes the timing histograms to a CSV file; returns false if it couldn't be written
+        bool dumpTimings(const File& file) const;
+
+        // Single-trial epochs, written to a new file in archiveDirectory each time acquisition
+        // starts (no archive if archiveDirectory is empty)
+        EpochArchive archive;
+        File archiveDirectory;
+        uint64 archiveDropped; // epochs that didn't make it into the archive, as last logged
+        void openArchive();
+        void closeArchive();
 
-        vector<AudioSampleBuffer> curLFP; // Is this better???
-        // Calculations to send to visualizer
-        AtomicallyShared<vector<vector<RWA>>> avgSum; // Average area under curve (trigger(ttl 1-8) x channel)
-        AtomicallyShared<vector<vector<vector<RWA>>>> avgLFP; // Save the average waveform (trigger(ttl 1-8) x channel x vector of waveform)
-        AtomicallyShared<vector<vector<RWA>>> avgPeak; // Avg Peak height (trigger(ttl 1-8) x channel)
-        AtomicallyShared<vector<vector<RWA>>> avgTimeToPeak; // Avg time to the peak height (trigger(ttl 1-8) x channel)
+        // Replaces the averages with those of the epochs in an archive, recomputed with the
+        // current settings (only while acquisition is stopped); returns false if it couldn't
+        bool replayArchive(const File& file);
 
-        vector<vector<RWA>> localAvgSum;
-        vector<vector<vector<RWA>>> localAvgLFP;
-        vector<vector<RWA>> localAvgPeak;
-        vector<vector<RWA>> localAvgTimeToPeak;
+        // Calculations to send to visualizer: average waveform, area under curve, peak height
+        // and time to peak (trigger(ttl 1-8) x channel), published together
+        AtomicallyShared<ERPSnapshot> avgSnapshot;
 
         float ERPLenSec;
-        float ERPLenSamps;
-        vector<uint64> curSamp;
+        float ERPLenSamps; // whole epoch, including the pre-trigger window
+        float preLenSec; // pre-trigger window (for the baseline)
+        int preLenSamps;
         float alpha;
-        CriticalSection onlineReset;
+        int window; // only average the last window epochs of each trigger (0 for all of them)
+        bool robust; // waveform is a quantile of the epochs instead of their mean
+        float quantile; // which quantile (0.5 for the median)
 
         Array<EventSources> triggerChannels;
         Array<EventSources> eventSourceArray;
@@ -177,7 +205,11 @@ namespace RealTimeERP
         enum Parameter
         {
             ALPHA_E,
-            ERP_LEN
+            ERP_LEN,
+            PRE_LEN,
+            ROBUST,
+            QUANTILE,
+            WINDOW
         };
 	};
 }
@@ -27,7 +27,7 @@ using namespace RealTimeERP;
 
 /************** editor *************/
 ERPEditor::ERPEditor(Node* p)
-    : VisualizerEditor(p, 200, true)
+    : VisualizerEditor(p, 270, true)
 {
     tabText = "Real-Time ERP";
     processor = p;
@@ -54,12 +54,19 @@ ERPEditor::ERPEditor(Node* p)
     // Step Length
     static const String linearTip = "Linear weighting of ERPs.";
     linearButton = new ToggleButton("Linear");
-    linearButton->setBounds(bounds = { col0, row1, col1 - col0, TEXT_HT });
+    linearButton->setBounds(bounds = { col0, row1, 80, TEXT_HT });
     linearButton->setToggleState(true, dontSendNotification);
     linearButton->addListener(this);
     linearButton->setTooltip(linearTip);
     addAndMakeVisible(linearButton);
 
+    // Pre-trigger window (baseline)
+    preLenLabel = createLabel("preLabel", "Pre(s):", { col1 - 45, row1, 45, TEXT_HT });
+    addAndMakeVisible(preLenLabel);
+
+    preLenEditable = createEditable("preEditable", "0", "Input length of the pre-trigger window, used as the baseline", { col1, row1, 35, TEXT_HT });
+    addAndMakeVisible(preLenEditable);
+
     static const String expTip = "Exponential weighting of ERPs. Set alpha using -1/alpha weighting.";
     expButton = new ToggleButton("Exponential");
     expButton->setBounds(bounds = { col0, row2, col1 - col0, TEXT_HT });
@@ -74,6 +81,39 @@ ERPEditor::ERPEditor(Node* p)
     alphaE = createEditable("alphaEditable", "0", "Input Value of Alpha", { col1, row3, 35, 27 });
     addAndMakeVisible(alphaE);
 
+    static const String windowTip = "Average only the last N epochs of each trigger (boxcar). Keeps those epochs, so memory grows with N.";
+    windowButton = new ToggleButton("Last N:");
+    windowButton->setBounds(bounds = { col2, row0, 60, TEXT_HT });
+    windowButton->setToggleState(false, dontSendNotification);
+    windowButton->addListener(this);
+    windowButton->setTooltip(windowTip);
+    addAndMakeVisible(windowButton);
+
+    windowEditable = createEditable("windowEditable", "20", "Number of epochs to average", { col2 + 60, row0, 35, TEXT_HT });
+    addAndMakeVisible(windowEditable);
+
+    // Robust estimate (works with either weighting)
+    static const String robustTip = "Estimate the median (or another quantile) of the ERPs instead of their mean, so occasional artifacts don't skew the waveform.";
+    robustButton = new ToggleButton("Robust");
+    robustButton->setBounds(bounds = { col2, row1, 90, TEXT_HT });
+    robustButton->setToggleState(false, dontSendNotification);
+    robustButton->addListener(this);
+    robustButton->setTooltip(robustTip);
+    addAndMakeVisible(robustButton);
+
+    quantileLabel = createLabel("quantileLabel", "Quantile:", { col2, row2, 55, TEXT_HT });
+    addAndMakeVisible(quantileLabel);
+
+    quantileEditable = createEditable("quantileEditable", "0.5", "Quantile to estimate when robust (0.5 for the median)", { col2 + 55, row2, 35, TEXT_HT });
+    addAndMakeVisible(quantileEditable);
+
+    // Single-trial epoch archive
+    archiveButton = new ToggleButton("Archive");
+    archiveButton->setBounds(bounds = { col2, row3, 90, TEXT_HT });
+    archiveButton->addListener(this);
+    addAndMakeVisible(archiveButton);
+    updateArchiveButton();
+
     setEnabledState(false);
 }
 
@@ -125,6 +165,31 @@ void ERPEditor::labelTextChanged(Label* labelThatHasChanged)
             processor->setParameter(Node::ERP_LEN, static_cast<float>(newVal));
         }
     }
+    if (labelThatHasChanged == windowEditable)
+    {
+        int newVal;
+        if (updateIntLabel(labelThatHasChanged, 1, 10000, 20, &newVal) && windowButton->getToggleState())
+        {
+            processor->setParameter(Node::WINDOW, static_cast<float>(newVal));
+            updateWindowButton();
+        }
+    }
+    if (labelThatHasChanged == quantileEditable)
+    {
+        float newVal;
+        if (updateFloatLabel(labelThatHasChanged, 0.01f, 0.99f, 0.5f, &newVal))
+        {
+            processor->setParameter(Node::QUANTILE, static_cast<float>(newVal));
+        }
+    }
+    if (labelThatHasChanged == preLenEditable)
+    {
+        float newVal;
+        if (updateFloatLabel(labelThatHasChanged, 0, FLT_MAX, 0.0, &newVal))
+        {
+            processor->setParameter(Node::PRE_LEN, static_cast<float>(newVal));
+        }
+    }
 }
 
 void ERPEditor::buttonEvent(Button* buttonClicked)
@@ -132,12 +197,50 @@ void ERPEditor::buttonEvent(Button* buttonClicked)
     if (buttonClicked == linearButton)
     {
         processor->setParameter(Node::ALPHA_E, static_cast<float>(0));
+        processor->setParameter(Node::WINDOW, 0);
         expButton->setToggleState(false, dontSendNotification);
+        windowButton->setToggleState(false, dontSendNotification);
+    }
+
+    if (buttonClicked == windowButton)
+    {
+        int newVal;
+        if (windowButton->getToggleState() && updateIntLabel(windowEditable, 1, 10000, 20, &newVal))
+        {
+            processor->setParameter(Node::WINDOW, static_cast<float>(newVal));
+        }
+        else
+        {
+            processor->setParameter(Node::WINDOW, 0);
+        }
+        updateWindowButton();
+    }
+
+    if (buttonClicked == robustButton)
+    {
+        processor->setParameter(Node::ROBUST, robustButton->getToggleState() ? 1.0f : 0.0f);
+    }
+
+    if (buttonClicked == archiveButton)
+    {
+        processor->archiveDirectory = File();
+        if (archiveButton->getToggleState())
+        {
+            FileChooser chooser("Folder for the epoch archives",
+                File::getSpecialLocation(File::userDocumentsDirectory));
+            if (chooser.browseForDirectory())
+            {
+                processor->archiveDirectory = chooser.getResult();
+            }
+        }
+        updateArchiveButton();
     }
 
     if (buttonClicked == expButton)
     {
         linearButton->setToggleState(false, dontSendNotification);
+        windowButton->setToggleState(false, dontSendNotification);
+        processor->setParameter(Node::WINDOW, 0);
         float newVal;
         if (updateFloatLabel(alphaE, 0, FLT_MAX, 0.0, &newVal))
         {
@@ -168,8 +271,14 @@ void ERPEditor::startAcquisition()
 {
     alphaE->setEditable(false);
     ERPLenEditable->setEditable(false);
+    preLenEditable->setEditable(false);
+    quantileEditable->setEditable(false);
+    windowEditable->setEditable(false);
+    windowButton->setEnabled(false);
     expButton->setEnabled(false);
     linearButton->setEnabled(false);
+    robustButton->setEnabled(false);
+    archiveButton->setEnabled(false);
     if (canvas != NULL)
     {
         canvas->beginAnimation();
@@ -180,8 +289,14 @@ void ERPEditor::stopAcquisition()
 {
     alphaE->setEditable(true);
     ERPLenEditable->setEditable(true);
+    preLenEditable->setEditable(true);
+    quantileEditable->setEditable(true);
+    windowEditable->setEditable(true);
+    windowButton->setEnabled(true);
     expButton->setEnabled(true);
     linearButton->setEnabled(true);
+    robustButton->setEnabled(true);
+    archiveButton->setEnabled(true);
     if (canvas != NULL)
     {
         canvas->endAnimation();
@@ -198,6 +313,38 @@ void ERPEditor::updateSettings()
 {
     alphaE->setText(String(processor->alpha), dontSendNotification);
     ERPLenEditable->setText(String(processor->ERPLenSec), dontSendNotification);
+    preLenEditable->setText(String(processor->preLenSec), dontSendNotification);
+    quantileEditable->setText(String(processor->quantile), dontSendNotification);
+    robustButton->setToggleState(processor->robust, dontSendNotification);
+    updateWindowButton();
+    updateArchiveButton();
+}
+
+void ERPEditor::updateWindowButton()
+{
+    // (the node shortens or turns off a window that doesn't fit in memory)
+    windowButton->setToggleState(processor->window > 0, dontSendNotification);
+    if (processor->window > 0)
+    {
+        windowEditable->setText(String(processor->window), dontSendNotification);
+        linearButton->setToggleState(false, dontSendNotification);
+        expButton->setToggleState(false, dontSendNotification);
+    }
+    else
+    {
+        // Back to the decay the node uses without a window
+        linearButton->setToggleState(processor->alpha == 0, dontSendNotification);
+        expButton->setToggleState(processor->alpha != 0, dontSendNotification);
+    }
+}
+
+void ERPEditor::updateArchiveButton()
+{
+    String directory = processor->archiveDirectory.getFullPathName();
+    archiveButton->setToggleState(directory.isNotEmpty(), dontSendNotification);
+    archiveButton->setTooltip(directory.isNotEmpty()
+        ? "Each acquisition writes every single-trial epoch to a new file in " + directory
+        : "Write every single-trial epoch to a file, to re-analyze the session later");
 }
 
 
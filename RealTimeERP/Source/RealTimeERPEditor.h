@@ -65,12 +65,26 @@ namespace RealTimeERP
         // Length of ERP calculation
         ScopedPointer<Label> ERPLenLabel;
         ScopedPointer<Label> ERPLenEditable;
+        ScopedPointer<Label> preLenLabel;
+        ScopedPointer<Label> preLenEditable;
 
         // Decay
         ScopedPointer<ToggleButton> linearButton;
         ScopedPointer<ToggleButton> expButton;
         ScopedPointer<Label> alpha;
         ScopedPointer<Label> alphaE;
+        ScopedPointer<ToggleButton> windowButton;
+        ScopedPointer<Label> windowEditable;
+        void updateWindowButton();
+
+        // Robust (quantile) estimate of the waveform
+        ScopedPointer<ToggleButton> robustButton;
+        ScopedPointer<Label> quantileLabel;
+        ScopedPointer<Label> quantileEditable;
+
+        // Single-trial epoch archive
+        ScopedPointer<ToggleButton> archiveButton;
+        void updateArchiveButton();
         
         Label* ERPEditor::createLabel(const String& name, const String& text,
             juce::Rectangle<int> bounds);
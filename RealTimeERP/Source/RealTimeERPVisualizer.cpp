@@ -29,18 +29,38 @@ using namespace RealTimeERP;
 // Make sure to check for acquistion and keep things from changing
 // Channels, ttls to watch, alpha, length
 
+// Horizontal extent of the waveforms on the canvas
+static const int plotStart = 250;
+static const int plotEnd = 1000;
+
+// Most height of the heatmap (rows are at most channelYJump high, and share a pixel beyond that)
+static const int heatmapHeight = 512;
+
 /************** Visualizer *************/
 ERPVisualizer::ERPVisualizer(Node* n)
-	: viewport(new Viewport())
-	, canvas(new Component("canvas"))
+	: viewport(new RowViewport(*this))
+	, canvas(new Canvas(*this))
 	, processor		(n)
 	, canvasBounds	(0, 0, 1, 1)
 	//, chanList ({})
 	, chanLabels	({})
+	, firstVisibleRow	(0)
+	, numVisibleRows	(0)
 	, channelYStart	(140)
 	, channelYJump	(50)
 	, numChannels	(0)
 	, numTriggers	(0)
+	, bucketSamples	(1)
+	, waveformsDirty	(true)
+	, renderedBandScale	(0)
+	, renderedHeatmap	(false)
+	, waveformMid	(0)
+	, waveformRange	(0)
+	, calcsDirty	(true)
+	, shownCalc	(0)
+	, pulledTrigger	(-1)
+	, pulledVersion	(0)
+	, pulledSamples	(0)
 	, acquisitionStarted	(false)
 {
 	refreshRate = 2;
@@ -86,6 +106,68 @@ ERPVisualizer::ERPVisualizer(Node* n)
 	canvas->addAndMakeVisible(instantButton);
 	canvasBounds = canvasBounds.getUnion(bounds);
 
+	// -- Error Bands -- //
+	bandsButton = new ToggleButton("95% Bands");
+	bandsButton->setBounds(bounds = { 600, 10, 110, 30 });
+	bandsButton->addListener(this);
+	bandsButton->setToggleState(true, dontSendNotification);
+	bandsButton->setTooltip("Shade the 95% confidence interval of the average waveform (+/- 1.96 standard errors)");
+	bandsButton->setColour(ToggleButton::textColourId, Colours::white);
+	canvas->addAndMakeVisible(bandsButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	// -- Heatmap -- //
+	heatmapButton = new ToggleButton("Heatmap");
+	heatmapButton->setBounds(bounds = { 840, 10, 100, 30 });
+	heatmapButton->addListener(this);
+	heatmapButton->setTooltip("Show the averages of all channels as one image, one row per channel (for many channels)");
+	heatmapButton->setColour(ToggleButton::textColourId, Colours::white);
+	canvas->addAndMakeVisible(heatmapButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	// Diverging colour map for the heatmap: blue (negative), white (0), red (positive)
+	heatmapColours.resize(heatmapLevels);
+	for (int i = 0; i < heatmapLevels; i++)
+	{
+		float x = float(i) / (heatmapLevels - 1) * 2 - 1;
+		Colour colour = x < 0 ? Colours::white.interpolatedWith(Colours::blue, -x)
+			: Colours::white.interpolatedWith(Colours::red, x);
+		heatmapColours[i] = colour.getPixelARGB();
+	}
+
+	// -- Replay -- //
+	replayButton = new TextButton("Replay Archive");
+	replayButton->setBounds(bounds = { 720, 15, 110, 20 });
+	replayButton->addListener(this);
+	replayButton->setTooltip("Recompute the averages from an epoch archive with the current settings (replaces the current averages)");
+	canvas->addAndMakeVisible(replayButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	// -- Diagnostics -- //
+	diagnosticsButton = new ToggleButton("Diagnostics");
+	diagnosticsButton->setBounds(bounds = { 1010, 10, 110, 30 });
+	diagnosticsButton->addListener(this);
+	diagnosticsButton->setTooltip("Show how long each part of processing a block takes");
+	diagnosticsButton->setColour(ToggleButton::textColourId, Colours::white);
+	canvas->addAndMakeVisible(diagnosticsButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	saveTimingsButton = new TextButton("Save Timings");
+	saveTimingsButton->setBounds(bounds = { 1130, 15, 100, 20 });
+	saveTimingsButton->addListener(this);
+	saveTimingsButton->setTooltip("Save the timing histograms to a CSV file");
+	canvas->addAndMakeVisible(saveTimingsButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
+	diagnosticsPanel = new Label("diagnosticsPanel", "");
+	diagnosticsPanel->setBounds(bounds = { 1010, 45, 480, 190 });
+	diagnosticsPanel->setFont(Font(Font::getDefaultMonospacedFontName(), 13, Font::plain));
+	diagnosticsPanel->setJustificationType(Justification::topLeft);
+	diagnosticsPanel->setColour(Label::textColourId, Colours::white);
+	diagnosticsPanel->setColour(Label::backgroundColourId, Colours::black.withAlpha(0.3f));
+	canvas->addChildComponent(diagnosticsPanel);
+	canvasBounds = canvasBounds.getUnion(bounds);
+
 	// -- Event Selector -- //
 	eventSelectLabel = createLabel("eventSelectLabel", "Select Events\nTo Watch ->", bounds = { 5, 45, 130, 50 });
 
@@ -121,6 +203,15 @@ ERPVisualizer::ERPVisualizer(Node* n)
 	{
 		trigSelect->setSelectedId(1);
 	}
+
+	// -- Reset Selected Trigger -- //
+	resetTriggerButton = new TextButton("Reset Event");
+	resetTriggerButton->setTooltip("Clear the calculations of the selected event only");
+	resetTriggerButton->setBounds(bounds = { eventX + 460, channelYStart - 25, 100, 20 });
+	resetTriggerButton->addListener(this);
+	resetTriggerButton->setColour(TextButton::buttonColourId, Colours::red);
+	canvas->addAndMakeVisible(resetTriggerButton);
+	canvasBounds = canvasBounds.getUnion(bounds);
 	
 
 	// -- Create Channel Row Labels -- //
@@ -134,20 +225,95 @@ ERPVisualizer::ERPVisualizer(Node* n)
 
 void ERPVisualizer::flipCanvas()
 {
-	canvasBounds.setBottom(canvasBounds.getBottom() + 10);
-	//canvasBounds.setRight(1000);
-	canvas->setBounds(canvasBounds);
+	// The rows are as tall as they'd be with every label in place, plus some padding
+	int rowsHeight = heatmapButton->getToggleState() ? roundToInt(numChannels * getHeatmapRowHeight())
+		: numChannels * channelYJump + channelYJump / 2 + 40;
+	juce::Rectangle<int> bounds = canvasBounds.getUnion({ 0, channelYStart, plotEnd, rowsHeight });
+	bounds.setBottom(bounds.getBottom() + 10);
+	canvas->setBounds(bounds);
 
 	viewport->setViewedComponent(canvas, false);
-	viewport->setScrollBarsShown(false, true);
+	viewport->setScrollBarsShown(true, true);
 	addAndMakeVisible(viewport);
 }
 
+void ERPVisualizer::getRowsIn(const juce::Rectangle<int>& area, int& first, int& end) const
+{
+	// Each row goes from its plot to the bottom of its labels
+	int rowExtent = channelYJump / 2 + 40;
+	first = jlimit(0, numChannels, int(std::floor(double(area.getY() - channelYStart - rowExtent) / channelYJump)) + 1);
+	end = jlimit(first, numChannels, int(std::ceil(double(area.getBottom() - channelYStart) / channelYJump)));
+}
+
+double ERPVisualizer::getHeatmapRowHeight() const
+{
+	return std::min(double(channelYJump), double(heatmapHeight) / std::max(1, numChannels));
+}
+
+void ERPVisualizer::updateVisibleRows()
+{
+	// (nothing to label before createChannelRowLabels())
+	if (calcLabels.isEmpty())
+	{
+		return;
+	}
+
+	int first, end;
+	getRowsIn(viewport->getViewArea(), first, end);
+	if (heatmapButton->getToggleState())
+	{
+		end = first; // (the heatmap labels itself)
+	}
+	firstVisibleRow = first;
+	numVisibleRows = end - first;
+
+	// Only as many labels and images as there are visible rows, reused as they scroll
+	while (chanLabels.size() < numVisibleRows)
+	{
+		chanLabels.add(createMovingLabel("ChanLabel", String(), { 5, 0, 125, 40 }));
+		calcLabels.add(createMovingLabel("Calc", String(), { 75, 0, 125, 40 }));
+	}
+	if (waveformImages.size() < numVisibleRows + 1)
+	{
+		// (moves every channel to another image)
+		waveformImages.resize(numVisibleRows + 1);
+		imageChannels.assign(waveformImages.size(), -1);
+	}
+
+	calcLabels[0]->setVisible(!heatmapButton->getToggleState());
+	for (int i = 0; i < chanLabels.size(); i++)
+	{
+		int row = first + i;
+		bool visible = i < numVisibleRows;
+		chanLabels[i]->setVisible(visible);
+		calcLabels[i + 1]->setVisible(visible);
+		if (!visible)
+		{
+			continue;
+		}
+
+		int yPos = channelYStart + row * channelYJump + channelYJump / 2;
+		chanLabels[i]->setTopLeftPosition(5, yPos);
+		calcLabels[i + 1]->setTopLeftPosition(75, yPos);
+		String text = "Chan" + String(processor->activeChannels[row] + 1) + " - ";
+		if (chanLabels[i]->getText() != text)
+		{
+			chanLabels[i]->setText(text, dontSendNotification);
+		}
+	}
+
+	// The rows now under the calculation labels may not be the ones they show
+	calcsDirty = true;
+	updateCalcLabels();
+}
+
 
 
 ERPVisualizer::~ERPVisualizer()
 {
 	stopCallbacks();
+	// (while the row labels still exist, as the viewport reports the change)
+	viewport->setViewedComponent(nullptr, false);
 }
 
 void ERPVisualizer::resized()
@@ -178,10 +344,16 @@ void ERPVisualizer::update()
 {
 	numChannels = processor->numChannels;
 	numTriggers = processor->triggerChannels.size();
-	avgLFP = vector<vector<vector<double>>>(numTriggers, vector<vector<double>>(numChannels, vector<double>(processor->ERPLenSamps, 0)));
-	avgSum = vector<vector<String>>(numTriggers, vector<String>(numChannels, "0"));
-	avgPeak = vector<vector<String>>(numTriggers, vector<String>(numChannels, "0"));
-	avgTimeToPeak = vector<vector<String>>(numTriggers, vector<String>(numChannels, "0"));
+	avgMin = vector<vector<double>>(numChannels); // (sized by pullSelectedTrigger)
+	avgMax = avgMin;
+	avgSE = avgMin;
+	bucketSamples = 1;
+	waveformsDirty = true;
+	avgSum = vector<double>(numChannels, 0);
+	avgPeak = avgSum;
+	avgTimeToPeak = avgSum;
+	calcsDirty = true;
+	pulledTrigger = -1; // (pull it again even if its version is the same)
 
 
 	createChannelRowLabels();
@@ -189,119 +361,397 @@ void ERPVisualizer::update()
 	resetTriggerChannels();
 }
 
-void ERPVisualizer::paint(Graphics& g) 
+void ERPVisualizer::paintCanvas(Graphics& g)
 {
-	// Draw out our ERPS
-	int trigIndex = trigSelect->getSelectedId() - 1;
-	if (trigIndex < 0) {
+	// Draw out our ERPS (those of the selected trigger, once they have been pulled)
+	if (pulledTrigger < 0) {
 		return;
 	}
-	int trig = processor->triggerChannels[trigIndex].channel;
-	double max = NULL;
-	double min = NULL;
-	for (int j = 0; j < numChannels; j++)
+
+	if (heatmapButton->getToggleState())
 	{
-		auto tempMax = std::max_element(avgLFP[trigIndex][j].begin(), avgLFP[trigIndex][j].end());
-		auto tempMin = std::min_element(avgLFP[trigIndex][j].begin(), avgLFP[trigIndex][j].end());
+		paintHeatmap(g);
+		return;
+	}
+
+	// Half width of the confidence band, in standard errors (0 to hide it)
+	double bandScale = bandsButton->getToggleState() ? 1.96 : 0;
+
+	// Only redraw the waveforms when they changed; scrolling etc. just copies the images
+	if (waveformsDirty || renderedHeatmap || bandScale != renderedBandScale)
+	{
+		scaleWaveforms(bandScale);
+	}
+
+	// Only the rows that need repainting
+	int first, end;
+	getRowsIn(g.getClipBounds(), first, end);
+	for (int chan = first; chan < end; chan++)
+	{
+		g.drawImageAt(getWaveformImage(chan), plotStart, channelYStart + chan * channelYJump);
+	}
+}
 
-		if (max == NULL || *tempMax > max)
+void ERPVisualizer::paintHeatmap(Graphics& g)
+{
+	if (waveformsDirty || !renderedHeatmap)
+	{
+		renderHeatmap();
+	}
+	if (heatmapImage.isNull())
+	{
+		return;
+	}
+
+	// One row per channel, one column per bucket, stretched over the plot without smoothing
+	int width = plotEnd - plotStart;
+	double rowHeight = getHeatmapRowHeight();
+	int height = roundToInt(rowHeight * numChannels);
+	double step = width / std::max(1.0, double(processor->ERPLenSamps)) * bucketSamples;
+	g.setImageResamplingQuality(Graphics::lowResamplingQuality);
+	g.drawImage(heatmapImage, plotStart, channelYStart, roundToInt(step * heatmapImage.getWidth()), height,
+		0, 0, heatmapImage.getWidth(), heatmapImage.getHeight());
+
+	// Mark the trigger if there is a pre-trigger window
+	if (processor->preLenSamps > 0)
+	{
+		float x = float(plotStart + width * processor->preLenSamps / std::max(1.0, double(processor->ERPLenSamps)));
+		g.setColour(Colours::grey);
+		g.fillRect(x, float(channelYStart), 1.0f, float(height));
+	}
+
+	// Label every few rows (the row labels of the line plot are hidden), if they need repainting
+	int labelEvery = std::max(1, int(std::ceil(15 / rowHeight)));
+	juce::Rectangle<int> clip = g.getClipBounds();
+	int first = std::max(0, int((clip.getY() - channelYStart - 12) / (rowHeight * labelEvery))) * labelEvery;
+	int end = std::min(numChannels, int((clip.getBottom() - channelYStart) / rowHeight) + 1);
+	g.setColour(Colours::white);
+	g.setFont(12);
+	for (int chan = first; chan < end; chan += labelEvery)
+	{
+		g.drawText("Chan" + String(processor->activeChannels[chan] + 1), plotStart - 70, channelYStart + int(chan * rowHeight),
+			65, std::max(int(rowHeight), 12), Justification::centredRight);
+	}
+}
+
+void ERPVisualizer::renderHeatmap()
+{
+	waveformsDirty = false;
+	renderedHeatmap = true;
+
+	int numBuckets = numChannels > 0 ? int(avgMin[0].size()) : 0;
+	if (numBuckets == 0)
+	{
+		heatmapImage = Image();
+		return;
+	}
+	if (heatmapImage.isNull() || heatmapImage.getWidth() != numBuckets || heatmapImage.getHeight() != numChannels)
+	{
+		heatmapImage = Image(Image::ARGB, numBuckets, numChannels, false);
+	}
+
+	// Each bucket shows whichever of its lowest and highest values is furthest from 0 (so
+	// peaks aren't averaged away), scaled to the largest of all channels
+	double range = 0;
+	for (int chan = 0; chan < numChannels; chan++)
+	{
+		for (int b = 0; b < numBuckets; b++)
 		{
-			max = *tempMax;
+			range = std::max(range, std::max(-avgMin[chan][b], avgMax[chan][b]));
 		}
-		if (min == NULL || *tempMin < min)
+	}
+	float scale = range > 0 ? float((heatmapLevels - 1) / (2 * range)) : 0.0f;
+	float centre = (heatmapLevels - 1) / 2.0f;
+
+	Image::BitmapData pixels(heatmapImage, Image::BitmapData::writeOnly);
+	for (int chan = 0; chan < numChannels; chan++)
+	{
+		const double* lo = avgMin[chan].data();
+		const double* hi = avgMax[chan].data();
+		PixelARGB* row = reinterpret_cast<PixelARGB*>(pixels.getLinePointer(chan));
+		for (int b = 0; b < numBuckets; b++)
 		{
-			min = *tempMin;
+			float value = float(-lo[b] > hi[b] ? lo[b] : hi[b]);
+			int level = int(std::min(std::max(centre + value * scale, 0.0f), float(heatmapLevels - 1)) + 0.5f);
+			row[b] = heatmapColours[level];
 		}
 	}
-	double midPoint = max / 2 + min / 2;
-	double totalY = max - min;
-	// Make sure there is data
-	if (totalY > 0)
+}
+
+void ERPVisualizer::scaleWaveforms(double bandScale)
+{
+	waveformsDirty = false;
+	renderedHeatmap = false;
+	renderedBandScale = bandScale;
+	imageChannels.assign(waveformImages.size(), -1);
+
+	// Range of the waveforms (and bands) of all channels
+	double max = 0;
+	double min = 0;
+	bool first = true;
+	for (int j = 0; j < numChannels; j++)
 	{
-		// Loop through all channels
-		for (int chan = 0; chan < numChannels; chan++)
+		for (int b = 0; b < avgMin[j].size(); b++)
 		{
-			// Find pixel positions for start/end and top/bottom based on voltage data and length
-			double xPos = 250;
-			int xEnd = 1000;
-			int yPosMid = (channelYStart + (chan + 1) * (channelYJump)) - channelYJump / 2;
-
-			double step = (xEnd - xPos) / double(avgLFP[trigIndex][chan].size());
-
-			for (int samp = 0; samp < avgLFP[trigIndex][chan].size(); samp++)
+			double band = bandScale * avgSE[j][b];
+			if (first || avgMax[j][b] + band > max)
+			{
+				max = avgMax[j][b] + band;
+			}
+			if (first || avgMin[j][b] - band < min)
 			{
-				// Turn this into looping through ttl channels
-				g.setColour(colorList[chan]);
-				double ratio = (avgLFP[trigIndex][chan][samp] - midPoint) / totalY;
-				double yPos = yPosMid + channelYJump * ratio;
-				g.fillRect(xPos, yPos, 1, 1); // Draw pixel rects of data.. Maybe not the best way!
-				xPos += step;
+				min = avgMin[j][b] - band;
 			}
+			first = false;
+		}
+	}
+	waveformMid = max / 2 + min / 2;
+	waveformRange = max - min;
+}
+
+const Image& ERPVisualizer::getWaveformImage(int chan)
+{
+	// One image per visible row, covering the plot (reused while the layout stays the same)
+	int slot = chan % waveformImages.size();
+	Image& image = waveformImages[slot];
+	if (imageChannels[slot] == chan)
+	{
+		return image;
+	}
+	imageChannels[slot] = chan;
+
+	int width = plotEnd - plotStart;
+	if (image.isNull() || image.getWidth() != width || image.getHeight() != channelYJump)
+	{
+		image = Image(Image::ARGB, width, channelYJump, true);
+	}
+	else
+	{
+		image.clear(image.getBounds());
+	}
+
+	double bandScale = renderedBandScale;
+	double midPoint = waveformMid;
+	double totalY = waveformRange;
+	Colour colour = colorList[chan % colorList.size()];
+
+	// Make sure there is data
+	if (totalY <= 0)
+	{
+		return image;
+	}
+
+	Graphics g(image);
+	double yPosMid = channelYJump / 2;
+
+	// Pixels per sample, and per bucket of samples
+	double sampleStep = width / std::max(1.0, double(processor->ERPLenSamps));
+	double step = sampleStep * bucketSamples;
+
+	// Mark the trigger if there is a pre-trigger window
+	if (processor->preLenSamps > 0)
+	{
+		g.setColour(Colours::grey);
+		g.fillRect(float(sampleStep * processor->preLenSamps), 0.0f, 1.0f, float(channelYJump));
+	}
 
+	// Confidence band behind the waveform
+	RectangleList<float> rects;
+	if (bandScale > 0)
+	{
+		double xPos = 0;
+		for (int b = 0; b < avgMin[chan].size(); b++)
+		{
+			double band = bandScale * avgSE[chan][b];
+			double top = yPosMid + channelYJump * (avgMax[chan][b] + band - midPoint) / totalY;
+			double bottom = yPosMid + channelYJump * (avgMin[chan][b] - band - midPoint) / totalY;
+			rects.addWithoutMerging({ float(xPos), float(bottom), float(std::max(1.0, step)), float(top - bottom) });
+			xPos += step;
 		}
+		g.setColour(colour.withAlpha(0.3f));
+		g.fillRectList(rects);
+		rects.clear();
 	}
 
+	// One vertical bar per bucket, from its lowest to its highest value
+	double xPos = 0;
+	for (int b = 0; b < avgMin[chan].size(); b++)
+	{
+		double yLow = yPosMid + channelYJump * (avgMin[chan][b] - midPoint) / totalY;
+		double yHigh = yPosMid + channelYJump * (avgMax[chan][b] - midPoint) / totalY;
+		rects.addWithoutMerging({ float(xPos), float(yLow), float(std::max(1.0, step)), float(std::max(1.0, yHigh - yLow)) });
+		xPos += step;
+	}
+	g.setColour(colour);
+	g.fillRectList(rects);
+	return image;
 }
 
 void ERPVisualizer::refresh() 
 {
-	if (processor->avgSum.hasUpdate())
-	{
-		int numTriggers = processor->triggerChannels.size();
-		AtomicScopedReadPtr<vector<vector<RWA>>> sumReader(processor->avgSum);
-		AtomicScopedReadPtr<vector<vector<vector<RWA>>>> LFPReader(processor->avgLFP);
-		AtomicScopedReadPtr<vector<vector<RWA>>> peakReader(processor->avgPeak);
-		AtomicScopedReadPtr<vector<vector<RWA>>> ttPeakReader(processor->avgTimeToPeak);
-		sumReader.pullUpdate();
-		LFPReader.pullUpdate();
-		peakReader.pullUpdate();
-		ttPeakReader.pullUpdate();
-
-		for (int t = 0; t < numTriggers; t++)
+	if (diagnosticsPanel->isVisible())
+	{
+		updateDiagnostics();
+	}
+
+	if (pullSelectedTrigger())
+	{
+		waveformsDirty = true;
+		calcsDirty = true;
+		repaint();
+	}
+
+	updateCalcLabels();
+}
+
+bool ERPVisualizer::pullSelectedTrigger()
+{
+	int trigIndex = trigSelect->getSelectedId() - 1;
+	if (trigIndex < 0)
+	{
+		return false;
+	}
+
+	// Nothing to read unless the processor published something or another trigger was selected
+	if (!processor->avgSnapshot.hasUpdate() && trigIndex == pulledTrigger)
+	{
+		return false;
+	}
+
+	AtomicScopedReadPtr<ERPSnapshot> avgReader(processor->avgSnapshot);
+	if (!avgReader.isValid())
+	{
+		return false;
+	}
+
+	const AccumulatorStore& stats = avgReader->stats;
+	const AccumulatorStore& lfp = avgReader->lfp;
+	const EnvelopePyramid& envelope = avgReader->envelope;
+	if (trigIndex >= lfp.getNumTriggers())
+	{
+		return false;
+	}
+
+	// Published before the channels last changed; wait for one that matches
+	if (lfp.getNumChannels() != numChannels)
+	{
+		return false;
+	}
+
+	// Other triggers may have changed, or nothing at all (e.g. a setting was applied)
+	uint64_t version = avgReader->getVersion(trigIndex);
+	if (trigIndex == pulledTrigger && version == pulledVersion && lfp.getNumSamples() == pulledSamples)
+	{
+		return false;
+	}
+	pulledTrigger = trigIndex;
+	pulledVersion = version;
+	pulledSamples = lfp.getNumSamples();
+
+	// Only read as many buckets as there are pixels (or every sample, for short epochs)
+	int level = envelope.getLevelFor(plotEnd - plotStart);
+	bucketSamples = level >= 0 ? envelope.getBucketSize(level) : 1;
+	int numBuckets = level >= 0 ? envelope.getNumBuckets(level) : lfp.getNumSamples();
+
+	for (int chan = 0; chan < numChannels; chan++)
+	{
+		avgSum[chan] = stats.getAverage(trigIndex, chan, ERPSnapshot::AREA_UNDER_CURVE);
+		avgPeak[chan] = stats.getAverage(trigIndex, chan, ERPSnapshot::PEAK_HEIGHT);
+		avgTimeToPeak[chan] = stats.getAverage(trigIndex, chan, ERPSnapshot::TIME_TO_PEAK) / processor->fs;
+
+		vector<double>& lo = avgMin[chan];
+		vector<double>& hi = avgMax[chan];
+		vector<double>& se = avgSE[chan];
+		lo.resize(numBuckets);
+		hi.resize(numBuckets);
+		se.resize(numBuckets);
+		if (level >= 0)
 		{
-			for (int chan = 0; chan < numChannels; chan++)
+			const float* bucketMin = envelope.getMin(trigIndex, chan, level);
+			const float* bucketMax = envelope.getMax(trigIndex, chan, level);
+			const float* bucketM2 = envelope.getMaxM2(trigIndex, chan, level);
+			int numValid = std::min(numBuckets, envelope.getNumValidBuckets(trigIndex, level));
+			for (int b = 0; b < numValid; b++)
+			{
+				lo[b] = bucketMin[b];
+				hi[b] = bucketMax[b];
+				se[b] = lfp.getStandardErrorOf(trigIndex, bucketM2[b]);
+			}
+			for (int b = numValid; b < numBuckets; b++)
 			{
-				avgSum[t][chan] = String(sumReader->at(t)[chan].getAverage());
-				avgPeak[t][chan] = String(peakReader->at(t)[chan].getAverage());
-				avgTimeToPeak[t][chan] = String(ttPeakReader->at(t)[chan].getAverage() / processor->fs) + 's';
-				for (int n = 0; n < processor->ERPLenSamps; n++)
-				{
-					avgLFP[t][chan][n] = LFPReader->at(t)[chan][n].getAverage();
-				}
+				// (stale since the trigger was reset)
+				lo[b] = hi[b] = 0;
+				se[b] = lfp.getStandardErrorOf(trigIndex, 0);
 			}
 		}
+		else
+		{
+			for (int n = 0; n < numBuckets; n++)
+			{
+				lo[n] = hi[n] = lfp.getAverage(trigIndex, chan, n);
+				se[n] = lfp.getStandardError(trigIndex, chan, n);
+			}
+		}
+	}
+	return true;
+}
 
-		canvasBounds.setBottom(canvasBounds.getBottom() - 10);
-		flipCanvas();
+void ERPVisualizer::comboBoxChanged(ComboBox* comboBoxThatHasChanged)
+{
+	// Show the new selection right away rather than on the next refresh
+	if (comboBoxThatHasChanged == trigSelect && pullSelectedTrigger())
+	{
+		waveformsDirty = true;
+		calcsDirty = true;
 		repaint();
 	}
+	updateCalcLabels();
+}
 
-	int trigIndex = trigSelect->getSelectedId() - 1;
-	if (trigIndex < 0)
+void ERPVisualizer::updateCalcLabels()
+{
+	int calc = calcSelect->getSelectedId();
+	if (pulledTrigger < 0 || calcLabels.isEmpty())
 	{
 		return;
 	}
-	int trig = processor->triggerChannels[trigIndex].channel;
-	int calc = calcSelect->getSelectedId();
-	calcLabels.clear();
-	int xPos = 75;
-	calcLabels.add(createLabel(calcSelect->getText() + "label", calcSelect->getText(), { xPos, channelYStart - 5, 125 , 40 }));
-	for (int chan = 0; chan < numChannels; chan++)
+	if (!calcsDirty && calc == shownCalc)
 	{
+		return;
+	}
+	calcsDirty = false;
+	shownCalc = calc;
+
+	String text = calcSelect->getText();
+	if (calcLabels[0]->getText() != text)
+	{
+		calcLabels[0]->setText(text, dontSendNotification);
+	}
+	// Only the visible rows have labels
+	for (int i = 0; i < numVisibleRows; i++)
+	{
+		int chan = firstVisibleRow + i;
 		switch (calc)
 		{
 		case 1:
-			calcLabels.add(createLabel("Calc" + String(chan), avgSum[trigIndex][chan], { xPos, channelYStart + chan * channelYJump + channelYJump / 2, 125 , 40 }));
+			text = String(avgSum[chan]);
 			break;
 		case 2:
-			calcLabels.add(createLabel("Calc" + String(chan), avgPeak[trigIndex][chan], { xPos, channelYStart + chan * channelYJump + channelYJump / 2, 125 , 40 }));
+			text = String(avgPeak[chan]);
 			break;
 		case 3:
-			calcLabels.add(createLabel("Calc" + String(chan), avgTimeToPeak[trigIndex][chan], { xPos, channelYStart + chan * channelYJump + channelYJump / 2, 125 , 40 }));
+			text = String(avgTimeToPeak[chan]) + 's';
+			break;
+		default:
+			text = String();
 			break;
 		}
+		// (setText repaints the label itself when the text differs)
+		if (calcLabels[i + 1]->getText() != text)
+		{
+			calcLabels[i + 1]->setText(text, dontSendNotification);
+		}
 	}
-	repaint();
 }
 
 
@@ -379,6 +829,15 @@ void ERPVisualizer::buttonClicked(Button* buttonClicked)
 		//update();
 	}
 
+	if (buttonClicked == resetTriggerButton)
+	{
+		int trigIndex = trigSelect->getSelectedId() - 1;
+		if (trigIndex >= 0)
+		{
+			processor->visResetTrigger(trigIndex);
+		}
+	}
+
 	if (buttonClicked == instantButton)
 	{
 		processor->setInstOrAvg(true);
@@ -389,6 +848,34 @@ void ERPVisualizer::buttonClicked(Button* buttonClicked)
 		processor->setInstOrAvg(false);
 	}
 
+	if (buttonClicked == heatmapButton)
+	{
+		flipCanvas();
+		updateVisibleRows();
+		repaint();
+	}
+
+	if (buttonClicked == bandsButton)
+	{
+		repaint();
+	}
+
+	if (buttonClicked == diagnosticsButton)
+	{
+		diagnosticsPanel->setVisible(diagnosticsButton->getToggleState());
+		updateDiagnostics();
+	}
+
+	if (buttonClicked == saveTimingsButton)
+	{
+		saveTimings();
+	}
+
+	if (buttonClicked == replayButton)
+	{
+		replayArchive();
+	}
+
 	if (ttlButtons.contains((ElectrodeButton*)buttonClicked))
 	{
 		if (acquisitionStarted == false)
@@ -430,34 +917,96 @@ void ERPVisualizer::channelChanged(int chan, bool newState)
 
 void ERPVisualizer::createChannelRowLabels()
 {
-	// Remove edging (bounds grow infintely if you don't)
-	canvasBounds.setBottom(canvasBounds.getBottom() - 10);
-	// Redraw all for simplicity
+	// Start over; updateVisibleRows() makes labels (and images) for the rows in view
 	chanLabels.clear();
-	for (int i = 0; i < numChannels; i++)
-	{
-		chanLabels.add(createLabel("ChanLabel" + String(processor->activeChannels[i] + 1), "Chan" + String(processor->activeChannels[i] + 1) + " - ", { 5, channelYStart + i * channelYJump + channelYJump / 2, 125 , 40 }));
-	}
+	calcLabels.clear();
+	waveformImages.clear();
+	imageChannels.clear();
+	calcLabels.add(createLabel("CalcLabel", String(), { 75, channelYStart - 5, 125 , 40 }));
 	// Redraw Canvas
 	flipCanvas();
+	updateVisibleRows();
 }
 
 Label* ERPVisualizer::createLabel(const String& name, const String& text,
 	juce::Rectangle<int> bounds)
+{
+	Label* label = createMovingLabel(name, text, bounds);
+	canvasBounds = canvasBounds.getUnion(bounds);
+	return label;
+}
+
+Label* ERPVisualizer::createMovingLabel(const String& name, const String& text,
+	juce::Rectangle<int> bounds)
 {
 	Label* label = new Label(name, text);
 	label->setBounds(bounds);
 	label->setFont(Font("Chan Labels", 20, Font::bold));
 	label->setColour(Label::textColourId, Colours::white);
 	canvas->addAndMakeVisible(label);
-	canvasBounds = canvasBounds.getUnion(bounds);
 	return label;
 }
 
 
+void ERPVisualizer::updateDiagnostics()
+{
+	const ProcessTimings& timings = processor->timings;
+
+	// Times in microseconds, counts as they are
+	String text = String("                  p50       p99       p99.9     max\n");
+	for (int m = 0; m < ProcessTimings::NUM_METRICS; m++)
+	{
+		ProcessTimings::Metric metric = ProcessTimings::Metric(m);
+		const ProcessTimings::Histogram& h = timings.get(metric);
+		bool isTime = String(ProcessTimings::getUnit(metric)) == "ns";
+		double scale = isTime ? 1e-3 : 1;
+		String unit = isTime ? "us" : ProcessTimings::getUnit(metric);
+
+		text << String(ProcessTimings::getName(metric)).paddedRight(' ', 18);
+		text << (String(h.getPercentile(50) * scale, 1) + unit).paddedRight(' ', 10);
+		text << (String(h.getPercentile(99) * scale, 1) + unit).paddedRight(' ', 10);
+		text << (String(h.getPercentile(99.9) * scale, 1) + unit).paddedRight(' ', 10);
+		text << String(h.getMax() * scale, 1) + unit << "\n";
+	}
+	text << "\n" << String(timings.get(ProcessTimings::BLOCK).getNumValues()) << " blocks since acquisition started";
+
+	diagnosticsPanel->setText(text, dontSendNotification);
+}
+
+void ERPVisualizer::saveTimings()
+{
+	FileChooser chooser("Save timing histograms",
+		File::getSpecialLocation(File::userHomeDirectory).getChildFile("RealTimeERP_timings.csv"), "*.csv");
+
+	if (chooser.browseForFileToSave(true))
+	{
+		File file = chooser.getResult();
+		if (processor->dumpTimings(file))
+		{
+			CoreServices::sendStatusMessage("Saved timings to " + file.getFullPathName());
+		}
+		else
+		{
+			CoreServices::sendStatusMessage("Could not save timings to " + file.getFullPathName());
+		}
+	}
+}
+
+void ERPVisualizer::replayArchive()
+{
+	FileChooser chooser("Replay epoch archive",
+		File::getSpecialLocation(File::userDocumentsDirectory), "*.erp");
+
+	if (chooser.browseForFileToOpen() && processor->replayArchive(chooser.getResult()))
+	{
+		refresh();
+	}
+}
+
 void ERPVisualizer::beginAnimation() 
 {
 	acquisitionStarted = true;
+	replayButton->setEnabled(false);
 	//resetButton->setEnabled(false);
 	//instantButton->setEnabled(false);
 	//averageButton->setEnabled(false);
@@ -472,6 +1021,7 @@ void ERPVisualizer::beginAnimation()
 void ERPVisualizer::endAnimation() 
 {
 	acquisitionStarted = false;
+	replayButton->setEnabled(true);
 	//resetButton->setEnabled(true);
 	//instantButton->setEnabled(true);
 	//averageButton->setEnabled(true);
@@ -53,38 +53,107 @@ namespace RealTimeERP
         void endAnimation() override;
         void setParameter(int, float) override;
         void setParameter(int, int, int, float) override;
-        void comboBoxChanged(ComboBox* comboBoxThatHasChanged)  override {};
+        void comboBoxChanged(ComboBox* comboBoxThatHasChanged)  override;
         void labelTextChanged(Label* labelThatHasChanged) override {};
         void buttonClicked(Button* buttonClick) override;
-        void paint(Graphics& g) override;
 
         void channelChanged(int chan, bool newState);
         void createElectrodeButtons();
 
     private:
+        // Component the plots are painted on (by paintCanvas()), so they scroll with the labels
+        class Canvas : public Component
+        {
+        public:
+            Canvas(ERPVisualizer& v) : Component("canvas"), owner(v) {}
+            void paint(Graphics& g) override { owner.paintCanvas(g); }
+
+        private:
+            ERPVisualizer& owner;
+        };
+
+        // Viewport that lets the visualizer know when the visible part of the canvas changes
+        class RowViewport : public Viewport
+        {
+        public:
+            RowViewport(ERPVisualizer& v) : owner(v) {}
+            void visibleAreaChanged(const juce::Rectangle<int>&) override { owner.updateVisibleRows(); }
+
+        private:
+            ERPVisualizer& owner;
+        };
+
         Node* processor;
 
-        // Creates labeled rows based on num active channels
+        // Creates labeled rows based on num active channels (only the visible ones get labels;
+        // see updateVisibleRows)
         void createChannelRowLabels();
-        // Code to show canvas. Save on copy/pasting
+        // Code to show canvas. Save on copy/pasting (its height is computed from the rows)
         void flipCanvas();
+        // Gives the rows labels, and an image to draw them in, only when they're scrolled into
+        // view; the labels are reused as they scroll out
+        void updateVisibleRows();
+        // Rows [first, end) that intersect an area of the canvas
+        void getRowsIn(const juce::Rectangle<int>& area, int& first, int& end) const;
+        // Height of each row of the heatmap (under a pixel when there are more channels than fit)
+        double getHeatmapRowHeight() const;
         void resetTriggerChannels();
 
         Label* createLabel(const String& name, const String& text, juce::Rectangle<int> bounds);
-
-        ScopedPointer<Viewport>  viewport;
-        ScopedPointer<Component> canvas;
-        juce::Rectangle<int> canvasBounds;
+        // Same, without adding it to canvasBounds (for labels that move)
+        Label* createMovingLabel(const String& name, const String& text, juce::Rectangle<int> bounds);
+
+        // Copies the data of the selected trigger from the processor's snapshot, if it has
+        // changed since it was last pulled (or another trigger was selected); returns whether it did
+        bool pullSelectedTrigger();
+
+        // Shows the selected calculation of the selected trigger in calcLabels; only formats
+        // them when something changed, and only sets the text of those that differ
+        void updateCalcLabels();
+
+        // Paints the visible rows of the plots, or the heatmap
+        void paintCanvas(Graphics& g);
+
+        // Scales the pulled waveforms (and bands) of all channels together, and marks every
+        // image in waveformImages out of date
+        void scaleWaveforms(double bandScale);
+        // Image of a channel's waveform, drawn first if it isn't in waveformImages yet
+        const Image& getWaveformImage(int chan);
+
+        // Draws the pulled waveforms of all channels as one image, a row per channel and a
+        // colour (from heatmapColours) per bucket, instead of a plot per channel
+        void renderHeatmap();
+        void paintHeatmap(Graphics& g);
+
+        // Fills the diagnostics panel from the processor's timing histograms
+        void updateDiagnostics();
+        // Asks where to save the timing histograms and saves them there
+        void saveTimings();
+        // Asks for an epoch archive and shows its averages, recomputed with the current settings
+        void replayArchive();
+
+        ScopedPointer<RowViewport>  viewport;
+        ScopedPointer<Canvas> canvas;
+        juce::Rectangle<int> canvasBounds; // everything but the rows
 
         ScopedPointer<Label> title;
         ScopedPointer<TextButton> resetButton;
+        ScopedPointer<TextButton> resetTriggerButton;
         ScopedPointer<ToggleButton> averageButton;
         ScopedPointer<ToggleButton> instantButton;
+        ScopedPointer<ToggleButton> bandsButton;
+        ScopedPointer<ToggleButton> heatmapButton;
+        ScopedPointer<TextButton> replayButton;
         ScopedPointer<ComboBox> calcSelect;
         ScopedPointer<ComboBox> trigSelect;
-
-        Array<ScopedPointer<Label>> chanLabels;
-        Array<ScopedPointer<Label>> calcLabels;
+        ScopedPointer<ToggleButton> diagnosticsButton;
+        ScopedPointer<TextButton> saveTimingsButton;
+        ScopedPointer<Label> diagnosticsPanel;
+
+        Array<ScopedPointer<Label>> chanLabels; // labels of the visible rows (firstVisibleRow and on)
+        Array<ScopedPointer<Label>> calcLabels; // name of the calculation, then one per visible row (made with chanLabels)
+        int firstVisibleRow;
+        int numVisibleRows;
         ScopedPointer<Label> eventSelectLabel;
         ScopedPointer<Label> eventViewerLabel;
 
@@ -102,11 +171,40 @@ namespace RealTimeERP
         ScopedPointer<Label> ttlButtonLabel;
         Array<ElectrodeButton*> ttlButtons;
 
-        // Store most recent update so we decide which to show a
-        vector<vector<String>> avgSum; // Average area under curve (trigger(ttl 1-8) x channel)
-        vector<vector<vector<double>>> avgLFP; // Save the average waveform (trigger(ttl 1-8) x channel x vector of waveform)
-        vector<vector<String>> avgPeak; // Avg Peak height (trigger(ttl 1-8) x channel)
-        vector<vector<String>> avgTimeToPeak; // Avg time to the peak height (trigger(ttl 1-8) x channel)
+        // Data of the selected trigger as last pulled from the processor's snapshot (the other
+        // triggers aren't read until they're selected)
+        vector<double> avgSum; // Average area under curve (channel)
+        vector<vector<double>> avgMin; // Average waveform, lowest value in each pixel-sized bucket of samples (channel x bucket)
+        vector<vector<double>> avgMax; // Highest value in each bucket (same as avgMin)
+        vector<vector<double>> avgSE; // Largest standard error of the average in each bucket (same as avgMin)
+        int bucketSamples; // samples per bucket (the last one may have fewer)
+
+        // Waveforms of the visible channels as last drawn (their rows of the plot), so that
+        // repaints that don't come with new data (refreshes of the labels etc.) only copy
+        // images. Channel c is kept in image c % size, which is as many as there are visible rows.
+        vector<Image> waveformImages;
+        vector<int> imageChannels; // channel drawn in each image (-1 if none)
+        bool waveformsDirty; // there is new data since they were scaled
+        double renderedBandScale; // bands they were scaled with
+        bool renderedHeatmap; // whether the heatmap was drawn last instead (then they're stale)
+        double waveformMid; // value at the middle of each row
+        double waveformRange; // values that span a row (0 if there is no data)
+
+        // Heatmap as last drawn (channel x bucket, scaled to the plot when painted)
+        static const int heatmapLevels = 256;
+        vector<PixelARGB> heatmapColours; // colour of each level, from most negative to most positive
+        Image heatmapImage;
+        vector<double> avgPeak; // Avg Peak height (channel)
+        vector<double> avgTimeToPeak; // Avg time to the peak height, in seconds (channel)
+
+        // What calcLabels show, so they're only updated when it changes
+        bool calcsDirty; // there are new calculations since they were updated
+        int shownCalc; // which calculation (id in calcSelect)
+
+        // Which data was pulled, so the snapshot is only read when it changes
+        int pulledTrigger; // trigger index (-1 for none)
+        uint64_t pulledVersion; // its version in the snapshot (ERPSnapshot::getVersion(trigger))
+        int pulledSamples; // samples per epoch of the snapshot
  
 
         JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ERPVisualizer);
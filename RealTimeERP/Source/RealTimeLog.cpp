@@ -0,0 +1,106 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "RealTimeLog.h"
+
+using namespace RealTimeERP;
+
+RealTimeLog::RealTimeLog(int capacity, int maxMessages)
+    : entries       (capacity)
+    , maxPerDrain   (maxMessages)
+    , minimumLevel  (LOG_INFO)
+    , numSinceDrain (0)
+    , numSuppressed (0)
+{
+    resetCounters();
+}
+
+void RealTimeLog::log(Level level, const char* message, int numValues, int64_t value1, int64_t value2)
+{
+    if (level < getMinimumLevel())
+    {
+        return;
+    }
+
+    // rate limit (errors always get through as long as there's room)
+    if (numSinceDrain.fetch_add(1, std::memory_order_relaxed) >= maxPerDrain && level < LOG_ERROR)
+    {
+        numSuppressed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Entry entry;
+    entry.level = level;
+    entry.message = message;
+    entry.numValues = numValues;
+    entry.values[0] = value1;
+    entry.values[1] = value2;
+
+    if (!entries.push(entry))
+    {
+        numSuppressed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void RealTimeLog::drain(std::ostream& out, const char* prefix)
+{
+    Entry entry;
+    while (entries.pop(entry))
+    {
+        out << prefix << getLevelName(entry.level) << entry.message;
+        for (int i = 0; i < entry.numValues && i < 2; ++i)
+        {
+            out << ' ' << entry.values[i];
+        }
+        out << '\n';
+    }
+
+    uint64_t suppressed = numSuppressed.exchange(0, std::memory_order_relaxed);
+    if (suppressed > 0)
+    {
+        out << prefix << "(" << suppressed << " messages suppressed)\n";
+    }
+
+    numSinceDrain.store(0, std::memory_order_relaxed);
+    out.flush();
+}
+
+void RealTimeLog::resetCounters()
+{
+    for (int c = 0; c < NUM_COUNTERS; ++c)
+    {
+        counters[c].store(0, std::memory_order_relaxed);
+    }
+}
+
+const char* RealTimeLog::getLevelName(Level level)
+{
+    switch (level)
+    {
+    case LOG_DEBUG:   return "[debug] ";
+    case LOG_INFO:    return "";
+    case LOG_WARNING: return "[warning] ";
+    case LOG_ERROR:   return "[error] ";
+    default:          return "";
+    }
+}
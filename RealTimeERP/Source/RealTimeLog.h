@@ -0,0 +1,117 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef REAL_TIME_LOG_H_INCLUDED
+#define REAL_TIME_LOG_H_INCLUDED
+
+#include "LockFreeQueue.h"
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+/*
+* Log channel that can be written from the audio thread. log() copies a level, a pointer to a
+* string literal and up to two numbers into a lock-free queue; nothing is formatted, locked or
+* allocated until drain() prints the queued messages, which should happen on the message
+* thread (e.g. from a Timer).
+*
+* Messages below the minimum level are skipped right away. At most maxPerDrain messages are
+* queued between two drains; any more are counted and reported as suppressed, so a burst of
+* triggers can't flood the console.
+*
+* It also keeps a few counters (incremented with relaxed atomics) which can be read from any
+* thread, so diagnostics are available without logging every event.
+*
+* Like LockFreeQueue, log() must only be called from one thread at a time and drain() from one
+* thread at a time.
+*/
+
+namespace RealTimeERP
+{
+    class RealTimeLog
+    {
+    public:
+        enum Level
+        {
+            LOG_DEBUG = 0,
+            LOG_INFO,
+            LOG_WARNING,
+            LOG_ERROR
+        };
+
+        enum Counter
+        {
+            EVENTS_RECEIVED = 0,
+            EPOCHS_COMPLETED,
+            EVENTS_DROPPED,
+            NUM_COUNTERS
+        };
+
+        RealTimeLog(int capacity = 256, int maxPerDrain = 32);
+
+        /** Queues a message. The message must be a string literal (or otherwise outlive the
+            next drain). Values are printed after it, separated by spaces; numValues is 0-2. */
+        void log(Level level, const char* message, int numValues = 0, int64_t value1 = 0, int64_t value2 = 0);
+
+        /** Prints all queued messages, prefixed with prefix */
+        void drain(std::ostream& out, const char* prefix = "Real Time ERP: ");
+
+        void setMinimumLevel(Level level) { minimumLevel.store(level, std::memory_order_relaxed); }
+        Level getMinimumLevel() const { return minimumLevel.load(std::memory_order_relaxed); }
+
+        void increment(Counter counter, uint64_t amount = 1)
+        {
+            counters[counter].fetch_add(amount, std::memory_order_relaxed);
+        }
+
+        uint64_t getCount(Counter counter) const
+        {
+            return counters[counter].load(std::memory_order_relaxed);
+        }
+
+        void resetCounters();
+
+    private:
+        struct Entry
+        {
+            Level level;
+            const char* message;
+            int numValues;
+            int64_t values[2];
+        };
+
+        static const char* getLevelName(Level level);
+
+        LockFreeQueue<Entry> entries;
+        const int maxPerDrain;
+
+        std::atomic<Level> minimumLevel;
+        std::atomic<int> numSinceDrain; // messages queued or suppressed since the last drain
+        std::atomic<uint64_t> numSuppressed;
+
+        std::atomic<uint64_t> counters[NUM_COUNTERS];
+    };
+}
+
+#endif // REAL_TIME_LOG_H_INCLUDED
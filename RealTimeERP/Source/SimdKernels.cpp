@@ -0,0 +1,861 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "SimdKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ERP_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define ERP_X86 0
+#endif
+
+// MSVC allows any intrinsic anywhere; GCC and Clang need the target on each function.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define ERP_TARGET(isa)
+#else
+#define ERP_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+using namespace RealTimeERP;
+
+// Quantile estimator step size and outlier clipping, in units of the spread
+static const double quantileStep = 2.5;
+static const double spreadClip = 3;
+
+namespace
+{
+    typedef void (*AccumulateFn)(double*, const float*, int, double, double);
+    typedef void (*AccumulateWithVarianceFn)(double*, double*, const float*, int, double, double, double);
+    typedef void (*UpdateQuantileFn)(double*, double*, const float*, int, double, double, double);
+    typedef void (*SlideWindowFn)(double*, double*, float*, const float*, int, double, bool, double);
+    typedef void (*BucketMinMaxFn)(const double*, int, float*, float*);
+    typedef void (*AbsSumAndPeakFn)(const float*, int, float, int, double&, float&, int&);
+
+    /*********** Scalar ***********/
+
+    void accumulateScalar(double* avg, const float* x, int n, double gain, double shift)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            avg[i] += gain * (x[i] - shift - avg[i]);
+        }
+    }
+
+    void accumulateWithVarianceScalar(double* avg, double* m2, const float* x, int n, double gain,
+        double decay, double shift)
+    {
+        const double spread = 1 - gain;
+        for (int i = 0; i < n; ++i)
+        {
+            double d = x[i] - shift - avg[i];
+            avg[i] += gain * d;
+            m2[i] = decay * m2[i] + spread * d * d;
+        }
+    }
+
+    void updateQuantileScalar(double* est, double* spread, const float* x, int n, double gain,
+        double quantile, double shift)
+    {
+        const double up = gain * quantileStep * quantile;
+        const double down = gain * quantileStep * (quantile - 1);
+        for (int i = 0; i < n; ++i)
+        {
+            double d = x[i] - shift - est[i];
+            double a = std::fabs(d);
+            double s = spread[i];
+            est[i] += (d < 0 ? down : up) * s;
+            spread[i] = s + gain * ((s > 0 ? std::min(a, spreadClip * s) : a) - s);
+        }
+    }
+
+    void slideWindowScalar(double* avg, double* m2, float* ring, const float* x, int n, double gain,
+        bool evict, double shift)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            float d = float(x[i] - shift);
+            double a0 = avg[i];
+            double old = evict ? ring[i] : a0;
+            double a1 = a0 + gain * (d - old);
+            avg[i] = a1;
+            if (m2 != nullptr)
+            {
+                m2[i] += (d - old) * (d - a1 + old - a0);
+            }
+            ring[i] = d;
+        }
+    }
+
+    void bucketMinMaxScalar(const double* x, int numBuckets, float* minima, float* maxima)
+    {
+        for (int b = 0; b < numBuckets; ++b, x += 8)
+        {
+            if (minima != nullptr)
+            {
+                minima[b] = float(*std::min_element(x, x + 8));
+            }
+            maxima[b] = float(*std::max_element(x, x + 8));
+        }
+    }
+
+    void absSumAndPeakScalar(const float* x, int n, float shift, int indexOffset,
+        double& absSum, float& peak, int& peakIndex)
+    {
+        double s = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            float a = std::fabs(x[i] - shift);
+            s += a;
+            if (peak <= a)
+            {
+                peak = a;
+                peakIndex = indexOffset + i;
+            }
+        }
+        absSum += s;
+    }
+
+    // Combines per-lane maxima (each lane holding its last maximum) with the running peak
+    void reduceLanes(const float* laneMax, const int32_t* laneIndex, int nLanes,
+        int indexOffset, float& peak, int& peakIndex)
+    {
+        int best = -1;
+        for (int l = 0; l < nLanes; ++l)
+        {
+            if (laneIndex[l] < 0)
+            {
+                continue;
+            }
+            if (best < 0 || laneMax[l] > laneMax[best]
+                || (laneMax[l] == laneMax[best] && laneIndex[l] > laneIndex[best]))
+            {
+                best = l;
+            }
+        }
+
+        if (best >= 0 && peak <= laneMax[best])
+        {
+            peak = laneMax[best];
+            peakIndex = indexOffset + laneIndex[best];
+        }
+    }
+
+#if ERP_X86
+
+    /*********** SSE2 ***********/
+
+    ERP_TARGET("sse2")
+    void accumulateSSE2(double* avg, const float* x, int n, double gain, double shift)
+    {
+        const __m128d g = _mm_set1_pd(gain);
+        const __m128d sh = _mm_set1_pd(shift);
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 xv = _mm_loadu_ps(x + i);
+            __m128d lo = _mm_sub_pd(_mm_cvtps_pd(xv), sh);
+            __m128d hi = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(xv, xv)), sh);
+            __m128d a0 = _mm_loadu_pd(avg + i);
+            __m128d a1 = _mm_loadu_pd(avg + i + 2);
+            _mm_storeu_pd(avg + i, _mm_add_pd(a0, _mm_mul_pd(g, _mm_sub_pd(lo, a0))));
+            _mm_storeu_pd(avg + i + 2, _mm_add_pd(a1, _mm_mul_pd(g, _mm_sub_pd(hi, a1))));
+        }
+        accumulateScalar(avg + i, x + i, n - i, gain, shift);
+    }
+
+    ERP_TARGET("sse2")
+    void accumulateWithVarianceSSE2(double* avg, double* m2, const float* x, int n, double gain,
+        double decay, double shift)
+    {
+        const __m128d g = _mm_set1_pd(gain);
+        const __m128d dc = _mm_set1_pd(decay);
+        const __m128d sp = _mm_set1_pd(1 - gain);
+        const __m128d sh = _mm_set1_pd(shift);
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 xv = _mm_loadu_ps(x + i);
+            __m128d a0 = _mm_loadu_pd(avg + i);
+            __m128d a1 = _mm_loadu_pd(avg + i + 2);
+            __m128d d0 = _mm_sub_pd(_mm_sub_pd(_mm_cvtps_pd(xv), sh), a0);
+            __m128d d1 = _mm_sub_pd(_mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(xv, xv)), sh), a1);
+            _mm_storeu_pd(avg + i, _mm_add_pd(a0, _mm_mul_pd(g, d0)));
+            _mm_storeu_pd(avg + i + 2, _mm_add_pd(a1, _mm_mul_pd(g, d1)));
+            _mm_storeu_pd(m2 + i, _mm_add_pd(_mm_mul_pd(dc, _mm_loadu_pd(m2 + i)), _mm_mul_pd(sp, _mm_mul_pd(d0, d0))));
+            _mm_storeu_pd(m2 + i + 2, _mm_add_pd(_mm_mul_pd(dc, _mm_loadu_pd(m2 + i + 2)), _mm_mul_pd(sp, _mm_mul_pd(d1, d1))));
+        }
+        accumulateWithVarianceScalar(avg + i, m2 + i, x + i, n - i, gain, decay, shift);
+    }
+
+    ERP_TARGET("sse2")
+    void updateQuantileSSE2(double* est, double* spread, const float* x, int n, double gain,
+        double quantile, double shift)
+    {
+        const __m128d up = _mm_set1_pd(gain * quantileStep * quantile);
+        const __m128d down = _mm_set1_pd(gain * quantileStep * (quantile - 1));
+        const __m128d g = _mm_set1_pd(gain);
+        const __m128d clip = _mm_set1_pd(spreadClip);
+        const __m128d sh = _mm_set1_pd(shift);
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d absMask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+        int i = 0;
+        for (; i + 2 <= n; i += 2)
+        {
+            __m128d xv = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(x + i))));
+            __m128d e = _mm_loadu_pd(est + i);
+            __m128d s = _mm_loadu_pd(spread + i);
+            __m128d d = _mm_sub_pd(_mm_sub_pd(xv, sh), e);
+            __m128d a = _mm_and_pd(d, absMask);
+
+            __m128d neg = _mm_cmplt_pd(d, zero);
+            __m128d step = _mm_or_pd(_mm_and_pd(neg, down), _mm_andnot_pd(neg, up));
+            _mm_storeu_pd(est + i, _mm_add_pd(e, _mm_mul_pd(step, s)));
+
+            __m128d positive = _mm_cmpgt_pd(s, zero);
+            __m128d clipped = _mm_min_pd(a, _mm_mul_pd(clip, s));
+            a = _mm_or_pd(_mm_and_pd(positive, clipped), _mm_andnot_pd(positive, a));
+            _mm_storeu_pd(spread + i, _mm_add_pd(s, _mm_mul_pd(g, _mm_sub_pd(a, s))));
+        }
+        updateQuantileScalar(est + i, spread + i, x + i, n - i, gain, quantile, shift);
+    }
+
+    ERP_TARGET("sse2")
+    void slideWindowSSE2(double* avg, double* m2, float* ring, const float* x, int n, double gain,
+        bool evict, double shift)
+    {
+        const __m128d g = _mm_set1_pd(gain);
+        const __m128d sh = _mm_set1_pd(shift);
+        int i = 0;
+        for (; i + 2 <= n; i += 2)
+        {
+            __m128d xv = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(x + i))));
+            __m128 df = _mm_cvtpd_ps(_mm_sub_pd(xv, sh));
+            __m128d d = _mm_cvtps_pd(df);
+            __m128d a0 = _mm_loadu_pd(avg + i);
+            __m128d old = evict
+                ? _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(ring + i))))
+                : a0;
+            __m128d diff = _mm_sub_pd(d, old);
+            __m128d a1 = _mm_add_pd(a0, _mm_mul_pd(g, diff));
+            _mm_storeu_pd(avg + i, a1);
+            if (m2 != nullptr)
+            {
+                __m128d other = _mm_add_pd(_mm_sub_pd(d, a1), _mm_sub_pd(old, a0));
+                _mm_storeu_pd(m2 + i, _mm_add_pd(_mm_loadu_pd(m2 + i), _mm_mul_pd(diff, other)));
+            }
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(ring + i), _mm_castps_si128(df));
+        }
+        slideWindowScalar(avg + i, m2 != nullptr ? m2 + i : nullptr, ring + i, x + i, n - i, gain, evict, shift);
+    }
+
+    ERP_TARGET("sse2")
+    void bucketMinMaxSSE2(const double* x, int numBuckets, float* minima, float* maxima)
+    {
+        // two buckets at a time: each down to one vector, then across the pair
+        int b = 0;
+        for (; b + 2 <= numBuckets; b += 2, x += 16)
+        {
+            __m128d a[8];
+            for (int i = 0; i < 8; ++i)
+            {
+                a[i] = _mm_loadu_pd(x + 2 * i);
+            }
+            if (minima != nullptr)
+            {
+                __m128d m0 = _mm_min_pd(_mm_min_pd(a[0], a[1]), _mm_min_pd(a[2], a[3]));
+                __m128d m1 = _mm_min_pd(_mm_min_pd(a[4], a[5]), _mm_min_pd(a[6], a[7]));
+                __m128d r = _mm_min_pd(_mm_unpacklo_pd(m0, m1), _mm_unpackhi_pd(m0, m1));
+                _mm_storel_pi(reinterpret_cast<__m64*>(minima + b), _mm_cvtpd_ps(r));
+            }
+            __m128d m0 = _mm_max_pd(_mm_max_pd(a[0], a[1]), _mm_max_pd(a[2], a[3]));
+            __m128d m1 = _mm_max_pd(_mm_max_pd(a[4], a[5]), _mm_max_pd(a[6], a[7]));
+            __m128d r = _mm_max_pd(_mm_unpacklo_pd(m0, m1), _mm_unpackhi_pd(m0, m1));
+            _mm_storel_pi(reinterpret_cast<__m64*>(maxima + b), _mm_cvtpd_ps(r));
+        }
+        bucketMinMaxScalar(x, numBuckets - b, minima != nullptr ? minima + b : nullptr, maxima + b);
+    }
+
+    ERP_TARGET("sse2")
+    void absSumAndPeakSSE2(const float* x, int n, float shift, int indexOffset,
+        double& absSum, float& peak, int& peakIndex)
+    {
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 sh = _mm_set1_ps(shift);
+        const __m128i step = _mm_set1_epi32(4);
+        __m128d sumLo = _mm_setzero_pd();
+        __m128d sumHi = _mm_setzero_pd();
+        __m128 maxv = _mm_set1_ps(-1.0f);
+        __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+        __m128i maxIdx = _mm_set1_epi32(-1);
+
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 a = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(x + i), sh), absMask);
+            sumLo = _mm_add_pd(sumLo, _mm_cvtps_pd(a));
+            sumHi = _mm_add_pd(sumHi, _mm_cvtps_pd(_mm_movehl_ps(a, a)));
+
+            __m128 ge = _mm_cmpge_ps(a, maxv);
+            __m128i gei = _mm_castps_si128(ge);
+            maxv = _mm_or_ps(_mm_and_ps(ge, a), _mm_andnot_ps(ge, maxv));
+            maxIdx = _mm_or_si128(_mm_and_si128(gei, idx), _mm_andnot_si128(gei, maxIdx));
+            idx = _mm_add_epi32(idx, step);
+        }
+
+        double sums[2];
+        _mm_storeu_pd(sums, _mm_add_pd(sumLo, sumHi));
+        absSum += sums[0] + sums[1];
+
+        float laneMax[4];
+        int32_t laneIndex[4];
+        _mm_storeu_ps(laneMax, maxv);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(laneIndex), maxIdx);
+        reduceLanes(laneMax, laneIndex, 4, indexOffset, peak, peakIndex);
+
+        absSumAndPeakScalar(x + i, n - i, shift, indexOffset + i, absSum, peak, peakIndex);
+    }
+
+    /*********** AVX2 ***********/
+
+    ERP_TARGET("avx2")
+    void accumulateAVX2(double* avg, const float* x, int n, double gain, double shift)
+    {
+        const __m256d g = _mm256_set1_pd(gain);
+        const __m256d sh = _mm256_set1_pd(shift);
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 xv = _mm256_loadu_ps(x + i);
+            __m256d lo = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(xv)), sh);
+            __m256d hi = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(xv, 1)), sh);
+            __m256d a0 = _mm256_loadu_pd(avg + i);
+            __m256d a1 = _mm256_loadu_pd(avg + i + 4);
+            _mm256_storeu_pd(avg + i, _mm256_add_pd(a0, _mm256_mul_pd(g, _mm256_sub_pd(lo, a0))));
+            _mm256_storeu_pd(avg + i + 4, _mm256_add_pd(a1, _mm256_mul_pd(g, _mm256_sub_pd(hi, a1))));
+        }
+        accumulateScalar(avg + i, x + i, n - i, gain, shift);
+    }
+
+    ERP_TARGET("avx2")
+    void accumulateWithVarianceAVX2(double* avg, double* m2, const float* x, int n, double gain,
+        double decay, double shift)
+    {
+        const __m256d g = _mm256_set1_pd(gain);
+        const __m256d dc = _mm256_set1_pd(decay);
+        const __m256d sp = _mm256_set1_pd(1 - gain);
+        const __m256d sh = _mm256_set1_pd(shift);
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 xv = _mm256_loadu_ps(x + i);
+            __m256d a0 = _mm256_loadu_pd(avg + i);
+            __m256d a1 = _mm256_loadu_pd(avg + i + 4);
+            __m256d d0 = _mm256_sub_pd(_mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(xv)), sh), a0);
+            __m256d d1 = _mm256_sub_pd(_mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(xv, 1)), sh), a1);
+            _mm256_storeu_pd(avg + i, _mm256_add_pd(a0, _mm256_mul_pd(g, d0)));
+            _mm256_storeu_pd(avg + i + 4, _mm256_add_pd(a1, _mm256_mul_pd(g, d1)));
+            _mm256_storeu_pd(m2 + i, _mm256_add_pd(_mm256_mul_pd(dc, _mm256_loadu_pd(m2 + i)), _mm256_mul_pd(sp, _mm256_mul_pd(d0, d0))));
+            _mm256_storeu_pd(m2 + i + 4, _mm256_add_pd(_mm256_mul_pd(dc, _mm256_loadu_pd(m2 + i + 4)), _mm256_mul_pd(sp, _mm256_mul_pd(d1, d1))));
+        }
+        accumulateWithVarianceScalar(avg + i, m2 + i, x + i, n - i, gain, decay, shift);
+    }
+
+    ERP_TARGET("avx2")
+    void updateQuantileAVX2(double* est, double* spread, const float* x, int n, double gain,
+        double quantile, double shift)
+    {
+        const __m256d up = _mm256_set1_pd(gain * quantileStep * quantile);
+        const __m256d down = _mm256_set1_pd(gain * quantileStep * (quantile - 1));
+        const __m256d g = _mm256_set1_pd(gain);
+        const __m256d clip = _mm256_set1_pd(spreadClip);
+        const __m256d sh = _mm256_set1_pd(shift);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d absMask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256d xv = _mm256_cvtps_pd(_mm_loadu_ps(x + i));
+            __m256d e = _mm256_loadu_pd(est + i);
+            __m256d s = _mm256_loadu_pd(spread + i);
+            __m256d d = _mm256_sub_pd(_mm256_sub_pd(xv, sh), e);
+            __m256d a = _mm256_and_pd(d, absMask);
+
+            __m256d step = _mm256_blendv_pd(up, down, _mm256_cmp_pd(d, zero, _CMP_LT_OQ));
+            _mm256_storeu_pd(est + i, _mm256_add_pd(e, _mm256_mul_pd(step, s)));
+
+            __m256d clipped = _mm256_min_pd(a, _mm256_mul_pd(clip, s));
+            a = _mm256_blendv_pd(a, clipped, _mm256_cmp_pd(s, zero, _CMP_GT_OQ));
+            _mm256_storeu_pd(spread + i, _mm256_add_pd(s, _mm256_mul_pd(g, _mm256_sub_pd(a, s))));
+        }
+        updateQuantileScalar(est + i, spread + i, x + i, n - i, gain, quantile, shift);
+    }
+
+    ERP_TARGET("avx2")
+    void slideWindowAVX2(double* avg, double* m2, float* ring, const float* x, int n, double gain,
+        bool evict, double shift)
+    {
+        const __m256d g = _mm256_set1_pd(gain);
+        const __m256d sh = _mm256_set1_pd(shift);
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 df = _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(x + i)), sh));
+            __m256d d = _mm256_cvtps_pd(df);
+            __m256d a0 = _mm256_loadu_pd(avg + i);
+            __m256d old = evict ? _mm256_cvtps_pd(_mm_loadu_ps(ring + i)) : a0;
+            __m256d diff = _mm256_sub_pd(d, old);
+            __m256d a1 = _mm256_add_pd(a0, _mm256_mul_pd(g, diff));
+            _mm256_storeu_pd(avg + i, a1);
+            if (m2 != nullptr)
+            {
+                __m256d other = _mm256_add_pd(_mm256_sub_pd(d, a1), _mm256_sub_pd(old, a0));
+                _mm256_storeu_pd(m2 + i, _mm256_add_pd(_mm256_loadu_pd(m2 + i), _mm256_mul_pd(diff, other)));
+            }
+            _mm_storeu_ps(ring + i, df);
+        }
+        slideWindowScalar(avg + i, m2 != nullptr ? m2 + i : nullptr, ring + i, x + i, n - i, gain, evict, shift);
+    }
+
+    // Smallest/largest of each of four vectors (of four values each), as four floats
+    ERP_TARGET("avx2")
+    inline __m128 reduceMin4AVX2(__m256d a0, __m256d a1, __m256d a2, __m256d a3)
+    {
+        __m256d t0 = _mm256_min_pd(_mm256_unpacklo_pd(a0, a1), _mm256_unpackhi_pd(a0, a1));
+        __m256d t1 = _mm256_min_pd(_mm256_unpacklo_pd(a2, a3), _mm256_unpackhi_pd(a2, a3));
+        return _mm256_cvtpd_ps(_mm256_min_pd(_mm256_permute2f128_pd(t0, t1, 0x20), _mm256_permute2f128_pd(t0, t1, 0x31)));
+    }
+
+    ERP_TARGET("avx2")
+    inline __m128 reduceMax4AVX2(__m256d a0, __m256d a1, __m256d a2, __m256d a3)
+    {
+        __m256d t0 = _mm256_max_pd(_mm256_unpacklo_pd(a0, a1), _mm256_unpackhi_pd(a0, a1));
+        __m256d t1 = _mm256_max_pd(_mm256_unpacklo_pd(a2, a3), _mm256_unpackhi_pd(a2, a3));
+        return _mm256_cvtpd_ps(_mm256_max_pd(_mm256_permute2f128_pd(t0, t1, 0x20), _mm256_permute2f128_pd(t0, t1, 0x31)));
+    }
+
+    ERP_TARGET("avx2")
+    void bucketMinMaxAVX2(const double* x, int numBuckets, float* minima, float* maxima)
+    {
+        // four buckets at a time: each down to one vector, then across the four
+        int b = 0;
+        for (; b + 4 <= numBuckets; b += 4, x += 32)
+        {
+            __m256d a[8];
+            for (int i = 0; i < 8; ++i)
+            {
+                a[i] = _mm256_loadu_pd(x + 4 * i);
+            }
+            if (minima != nullptr)
+            {
+                _mm_storeu_ps(minima + b, reduceMin4AVX2(_mm256_min_pd(a[0], a[1]), _mm256_min_pd(a[2], a[3]),
+                    _mm256_min_pd(a[4], a[5]), _mm256_min_pd(a[6], a[7])));
+            }
+            _mm_storeu_ps(maxima + b, reduceMax4AVX2(_mm256_max_pd(a[0], a[1]), _mm256_max_pd(a[2], a[3]),
+                _mm256_max_pd(a[4], a[5]), _mm256_max_pd(a[6], a[7])));
+        }
+        bucketMinMaxScalar(x, numBuckets - b, minima != nullptr ? minima + b : nullptr, maxima + b);
+    }
+
+    ERP_TARGET("avx2")
+    void absSumAndPeakAVX2(const float* x, int n, float shift, int indexOffset,
+        double& absSum, float& peak, int& peakIndex)
+    {
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        const __m256 sh = _mm256_set1_ps(shift);
+        const __m256i step = _mm256_set1_epi32(8);
+        __m256d sumLo = _mm256_setzero_pd();
+        __m256d sumHi = _mm256_setzero_pd();
+        __m256 maxv = _mm256_set1_ps(-1.0f);
+        __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i maxIdx = _mm256_set1_epi32(-1);
+
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 a = _mm256_and_ps(_mm256_sub_ps(_mm256_loadu_ps(x + i), sh), absMask);
+            sumLo = _mm256_add_pd(sumLo, _mm256_cvtps_pd(_mm256_castps256_ps128(a)));
+            sumHi = _mm256_add_pd(sumHi, _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)));
+
+            __m256 ge = _mm256_cmp_ps(a, maxv, _CMP_GE_OQ);
+            maxv = _mm256_blendv_ps(maxv, a, ge);
+            maxIdx = _mm256_blendv_epi8(maxIdx, idx, _mm256_castps_si256(ge));
+            idx = _mm256_add_epi32(idx, step);
+        }
+
+        double sums[4];
+        _mm256_storeu_pd(sums, _mm256_add_pd(sumLo, sumHi));
+        absSum += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+
+        float laneMax[8];
+        int32_t laneIndex[8];
+        _mm256_storeu_ps(laneMax, maxv);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(laneIndex), maxIdx);
+        reduceLanes(laneMax, laneIndex, 8, indexOffset, peak, peakIndex);
+
+        absSumAndPeakScalar(x + i, n - i, shift, indexOffset + i, absSum, peak, peakIndex);
+    }
+
+    /*********** AVX-512 ***********/
+
+    ERP_TARGET("avx512f")
+    void accumulateAVX512(double* avg, const float* x, int n, double gain, double shift)
+    {
+        const __m512d g = _mm512_set1_pd(gain);
+        const __m512d sh = _mm512_set1_pd(shift);
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512d lo = _mm512_sub_pd(_mm512_cvtps_pd(_mm256_loadu_ps(x + i)), sh);
+            __m512d hi = _mm512_sub_pd(_mm512_cvtps_pd(_mm256_loadu_ps(x + i + 8)), sh);
+            __m512d a0 = _mm512_loadu_pd(avg + i);
+            __m512d a1 = _mm512_loadu_pd(avg + i + 8);
+            _mm512_storeu_pd(avg + i, _mm512_add_pd(a0, _mm512_mul_pd(g, _mm512_sub_pd(lo, a0))));
+            _mm512_storeu_pd(avg + i + 8, _mm512_add_pd(a1, _mm512_mul_pd(g, _mm512_sub_pd(hi, a1))));
+        }
+        accumulateScalar(avg + i, x + i, n - i, gain, shift);
+    }
+
+    ERP_TARGET("avx512f")
+    void accumulateWithVarianceAVX512(double* avg, double* m2, const float* x, int n, double gain,
+        double decay, double shift)
+    {
+        const __m512d g = _mm512_set1_pd(gain);
+        const __m512d dc = _mm512_set1_pd(decay);
+        const __m512d sp = _mm512_set1_pd(1 - gain);
+        const __m512d sh = _mm512_set1_pd(shift);
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512d a0 = _mm512_loadu_pd(avg + i);
+            __m512d a1 = _mm512_loadu_pd(avg + i + 8);
+            __m512d d0 = _mm512_sub_pd(_mm512_sub_pd(_mm512_cvtps_pd(_mm256_loadu_ps(x + i)), sh), a0);
+            __m512d d1 = _mm512_sub_pd(_mm512_sub_pd(_mm512_cvtps_pd(_mm256_loadu_ps(x + i + 8)), sh), a1);
+            _mm512_storeu_pd(avg + i, _mm512_add_pd(a0, _mm512_mul_pd(g, d0)));
+            _mm512_storeu_pd(avg + i + 8, _mm512_add_pd(a1, _mm512_mul_pd(g, d1)));
+            _mm512_storeu_pd(m2 + i, _mm512_add_pd(_mm512_mul_pd(dc, _mm512_loadu_pd(m2 + i)), _mm512_mul_pd(sp, _mm512_mul_pd(d0, d0))));
+            _mm512_storeu_pd(m2 + i + 8, _mm512_add_pd(_mm512_mul_pd(dc, _mm512_loadu_pd(m2 + i + 8)), _mm512_mul_pd(sp, _mm512_mul_pd(d1, d1))));
+        }
+        accumulateWithVarianceScalar(avg + i, m2 + i, x + i, n - i, gain, decay, shift);
+    }
+
+    ERP_TARGET("avx512f")
+    void updateQuantileAVX512(double* est, double* spread, const float* x, int n, double gain,
+        double quantile, double shift)
+    {
+        const __m512d up = _mm512_set1_pd(gain * quantileStep * quantile);
+        const __m512d down = _mm512_set1_pd(gain * quantileStep * (quantile - 1));
+        const __m512d g = _mm512_set1_pd(gain);
+        const __m512d clip = _mm512_set1_pd(spreadClip);
+        const __m512d sh = _mm512_set1_pd(shift);
+        const __m512d zero = _mm512_setzero_pd();
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m512d xv = _mm512_cvtps_pd(_mm256_loadu_ps(x + i));
+            __m512d e = _mm512_loadu_pd(est + i);
+            __m512d s = _mm512_loadu_pd(spread + i);
+            __m512d d = _mm512_sub_pd(_mm512_sub_pd(xv, sh), e);
+            __m512d a = _mm512_abs_pd(d);
+
+            __m512d step = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(d, zero, _CMP_LT_OQ), up, down);
+            _mm512_storeu_pd(est + i, _mm512_add_pd(e, _mm512_mul_pd(step, s)));
+
+            __m512d clipped = _mm512_min_pd(a, _mm512_mul_pd(clip, s));
+            a = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(s, zero, _CMP_GT_OQ), a, clipped);
+            _mm512_storeu_pd(spread + i, _mm512_add_pd(s, _mm512_mul_pd(g, _mm512_sub_pd(a, s))));
+        }
+        updateQuantileScalar(est + i, spread + i, x + i, n - i, gain, quantile, shift);
+    }
+
+    ERP_TARGET("avx512f")
+    void slideWindowAVX512(double* avg, double* m2, float* ring, const float* x, int n, double gain,
+        bool evict, double shift)
+    {
+        const __m512d g = _mm512_set1_pd(gain);
+        const __m512d sh = _mm512_set1_pd(shift);
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 df = _mm512_cvtpd_ps(_mm512_sub_pd(_mm512_cvtps_pd(_mm256_loadu_ps(x + i)), sh));
+            __m512d d = _mm512_cvtps_pd(df);
+            __m512d a0 = _mm512_loadu_pd(avg + i);
+            __m512d old = evict ? _mm512_cvtps_pd(_mm256_loadu_ps(ring + i)) : a0;
+            __m512d diff = _mm512_sub_pd(d, old);
+            __m512d a1 = _mm512_add_pd(a0, _mm512_mul_pd(g, diff));
+            _mm512_storeu_pd(avg + i, a1);
+            if (m2 != nullptr)
+            {
+                __m512d other = _mm512_add_pd(_mm512_sub_pd(d, a1), _mm512_sub_pd(old, a0));
+                _mm512_storeu_pd(m2 + i, _mm512_add_pd(_mm512_loadu_pd(m2 + i), _mm512_mul_pd(diff, other)));
+            }
+            _mm256_storeu_ps(ring + i, df);
+        }
+        slideWindowScalar(avg + i, m2 != nullptr ? m2 + i : nullptr, ring + i, x + i, n - i, gain, evict, shift);
+    }
+
+    ERP_TARGET("avx512f")
+    void bucketMinMaxAVX512(const double* x, int numBuckets, float* minima, float* maxima)
+    {
+        // four buckets at a time, one per vector: halves, then across the four as for AVX2
+        int b = 0;
+        for (; b + 4 <= numBuckets; b += 4, x += 32)
+        {
+            __m512d a[4];
+            __m256d lo[4];
+            __m256d hi[4];
+            for (int i = 0; i < 4; ++i)
+            {
+                a[i] = _mm512_loadu_pd(x + 8 * i);
+                lo[i] = _mm512_castpd512_pd256(a[i]);
+                hi[i] = _mm512_extractf64x4_pd(a[i], 1);
+            }
+            if (minima != nullptr)
+            {
+                _mm_storeu_ps(minima + b, reduceMin4AVX2(_mm256_min_pd(lo[0], hi[0]), _mm256_min_pd(lo[1], hi[1]),
+                    _mm256_min_pd(lo[2], hi[2]), _mm256_min_pd(lo[3], hi[3])));
+            }
+            _mm_storeu_ps(maxima + b, reduceMax4AVX2(_mm256_max_pd(lo[0], hi[0]), _mm256_max_pd(lo[1], hi[1]),
+                _mm256_max_pd(lo[2], hi[2]), _mm256_max_pd(lo[3], hi[3])));
+        }
+        bucketMinMaxScalar(x, numBuckets - b, minima != nullptr ? minima + b : nullptr, maxima + b);
+    }
+
+    ERP_TARGET("avx512f")
+    void absSumAndPeakAVX512(const float* x, int n, float shift, int indexOffset,
+        double& absSum, float& peak, int& peakIndex)
+    {
+        const __m512i step = _mm512_set1_epi32(16);
+        const __m512 sh = _mm512_set1_ps(shift);
+        __m512d sumLo = _mm512_setzero_pd();
+        __m512d sumHi = _mm512_setzero_pd();
+        __m512 maxv = _mm512_set1_ps(-1.0f);
+        __m512i idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        __m512i maxIdx = _mm512_set1_epi32(-1);
+
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512 a = _mm512_abs_ps(_mm512_sub_ps(_mm512_loadu_ps(x + i), sh));
+            sumLo = _mm512_add_pd(sumLo, _mm512_cvtps_pd(_mm512_castps512_ps256(a)));
+            sumHi = _mm512_add_pd(sumHi, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1))));
+
+            __mmask16 ge = _mm512_cmp_ps_mask(a, maxv, _CMP_GE_OQ);
+            maxv = _mm512_mask_blend_ps(ge, maxv, a);
+            maxIdx = _mm512_mask_blend_epi32(ge, maxIdx, idx);
+            idx = _mm512_add_epi32(idx, step);
+        }
+
+        absSum += _mm512_reduce_add_pd(_mm512_add_pd(sumLo, sumHi));
+
+        float laneMax[16];
+        int32_t laneIndex[16];
+        _mm512_storeu_ps(laneMax, maxv);
+        _mm512_storeu_si512(laneIndex, maxIdx);
+        reduceLanes(laneMax, laneIndex, 16, indexOffset, peak, peakIndex);
+
+        absSumAndPeakScalar(x + i, n - i, shift, indexOffset + i, absSum, peak, peakIndex);
+    }
+
+    /*********** Detection ***********/
+
+    void cpuid(int leaf, int subleaf, unsigned int regs[4])
+    {
+#ifdef _MSC_VER
+        int r[4];
+        __cpuidex(r, leaf, subleaf);
+        for (int i = 0; i < 4; ++i)
+        {
+            regs[i] = static_cast<unsigned int>(r[i]);
+        }
+#else
+        __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    // Which register state the OS saves on context switches
+    unsigned long long xgetbv0()
+    {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        unsigned int eax, edx;
+        __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+    }
+
+    enum InstructionSet { SCALAR, SSE2, AVX2, AVX512 };
+
+    InstructionSet detectInstructionSet()
+    {
+        unsigned int regs[4];
+        cpuid(0, 0, regs);
+        unsigned int maxLeaf = regs[0];
+
+        cpuid(1, 0, regs);
+        bool sse2 = (regs[3] & (1u << 26)) != 0;
+        bool osxsave = (regs[2] & (1u << 27)) != 0;
+        bool avx = (regs[2] & (1u << 28)) != 0;
+
+        if (!sse2)
+        {
+            return SCALAR;
+        }
+
+        if (!osxsave || !avx || maxLeaf < 7)
+        {
+            return SSE2;
+        }
+
+        unsigned long long xcr0 = xgetbv0();
+        bool osAVX = (xcr0 & 0x6) == 0x6;        // XMM and YMM state
+        bool osAVX512 = (xcr0 & 0xe6) == 0xe6;   // ... plus opmask and ZMM state
+
+        cpuid(7, 0, regs);
+        bool avx2 = (regs[1] & (1u << 5)) != 0;
+        bool avx512f = (regs[1] & (1u << 16)) != 0;
+
+        if (avx512f && osAVX512)
+        {
+            return AVX512;
+        }
+        if (avx2 && osAVX)
+        {
+            return AVX2;
+        }
+        return SSE2;
+    }
+
+#endif // ERP_X86
+
+    struct KernelTable
+    {
+        KernelTable()
+            : accumulate                (accumulateScalar)
+            , accumulateWithVariance    (accumulateWithVarianceScalar)
+            , updateQuantile            (updateQuantileScalar)
+            , slideWindow               (slideWindowScalar)
+            , bucketMinMax              (bucketMinMaxScalar)
+            , absSumAndPeak             (absSumAndPeakScalar)
+            , name                      ("Scalar")
+        {
+#if ERP_X86
+            switch (detectInstructionSet())
+            {
+            case AVX512:
+                accumulate = accumulateAVX512;
+                accumulateWithVariance = accumulateWithVarianceAVX512;
+                updateQuantile = updateQuantileAVX512;
+                slideWindow = slideWindowAVX512;
+                bucketMinMax = bucketMinMaxAVX512;
+                absSumAndPeak = absSumAndPeakAVX512;
+                name = "AVX-512";
+                break;
+
+            case AVX2:
+                accumulate = accumulateAVX2;
+                accumulateWithVariance = accumulateWithVarianceAVX2;
+                updateQuantile = updateQuantileAVX2;
+                slideWindow = slideWindowAVX2;
+                bucketMinMax = bucketMinMaxAVX2;
+                absSumAndPeak = absSumAndPeakAVX2;
+                name = "AVX2";
+                break;
+
+            case SSE2:
+                accumulate = accumulateSSE2;
+                accumulateWithVariance = accumulateWithVarianceSSE2;
+                updateQuantile = updateQuantileSSE2;
+                slideWindow = slideWindowSSE2;
+                bucketMinMax = bucketMinMaxSSE2;
+                absSumAndPeak = absSumAndPeakSSE2;
+                name = "SSE2";
+                break;
+
+            default:
+                break;
+            }
+#endif
+        }
+
+        AccumulateFn accumulate;
+        AccumulateWithVarianceFn accumulateWithVariance;
+        UpdateQuantileFn updateQuantile;
+        SlideWindowFn slideWindow;
+        BucketMinMaxFn bucketMinMax;
+        AbsSumAndPeakFn absSumAndPeak;
+        const char* name;
+    };
+
+    // chosen when the plugin is loaded
+    const KernelTable kernels;
+}
+
+void Kernels::accumulate(double* avg, const float* x, int n, double gain, double shift)
+{
+    kernels.accumulate(avg, x, n, gain, shift);
+}
+
+void Kernels::accumulateWithVariance(double* avg, double* m2, const float* x, int n, double gain,
+    double decay, double shift)
+{
+    kernels.accumulateWithVariance(avg, m2, x, n, gain, decay, shift);
+}
+
+void Kernels::updateQuantile(double* est, double* spread, const float* x, int n, double gain,
+    double quantile, double shift)
+{
+    kernels.updateQuantile(est, spread, x, n, gain, quantile, shift);
+}
+
+void Kernels::slideWindow(double* avg, double* m2, float* ring, const float* x, int n, double gain,
+    bool evict, double shift)
+{
+    kernels.slideWindow(avg, m2, ring, x, n, gain, evict, shift);
+}
+
+void Kernels::bucketMinMax(const double* x, int numBuckets, float* minima, float* maxima)
+{
+    kernels.bucketMinMax(x, numBuckets, minima, maxima);
+}
+
+void Kernels::absSumAndPeak(const float* x, int n, int indexOffset,
+    double& absSum, float& peak, int& peakIndex, float shift)
+{
+    kernels.absSumAndPeak(x, n, shift, indexOffset, absSum, peak, peakIndex);
+}
+
+const char* Kernels::getInstructionSetName()
+{
+    return kernels.name;
+}
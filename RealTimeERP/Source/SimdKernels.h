@@ -0,0 +1,88 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SIMD_KERNELS_H_INCLUDED
+#define SIMD_KERNELS_H_INCLUDED
+
+/*
+* Vectorized inner loops for epoch statistics. Each kernel has a scalar version and, on x86,
+* SSE2, AVX2 and AVX-512 versions. The fastest version supported by the CPU (and OS) is picked
+* once when the plugin is loaded, so the plugin doesn't need to be built for a particular
+* instruction set.
+*/
+
+namespace RealTimeERP
+{
+    namespace Kernels
+    {
+        /** avg[i] += gain * (x[i] - shift - avg[i]), for i in [0, n) */
+        void accumulate(double* avg, const float* x, int n, double gain, double shift = 0);
+
+        /** Same as accumulate, also updating the weighted sum of squared deviations in the
+            same pass (West's weighted version of Welford's algorithm):
+            with d = x[i] - shift - avg[i] (before the update),
+            m2[i] = decay * m2[i] + (1 - gain) * d * d */
+        void accumulateWithVariance(double* avg, double* m2, const float* x, int n, double gain,
+            double decay, double shift = 0);
+
+        /** Stochastic approximation of a quantile instead of the mean, in one pass with
+            constant memory: with d = x[i] - shift - est[i] (before the update),
+                est[i] += gain * 2.5 * spread[i] * (quantile - (d < 0 ? 1 : 0))
+                spread[i] += gain * (min(|d|, 3 * spread[i]) - spread[i])
+            where spread is a (winsorized) mean absolute deviation, which scales the steps to
+            the data. With gain = 1/k this converges to the quantile of all epochs; with a
+            constant gain it tracks the quantile of recent epochs. (Not clipped while spread is 0.)
+        */
+        void updateQuantile(double* est, double* spread, const float* x, int n, double gain,
+            double quantile, double shift = 0);
+
+        /** Boxcar (last N epochs) average, where ring holds the values the oldest epoch in the
+            window added. With d = float(x[i] - shift) and old = evict ? ring[i] : avg[i],
+                avg[i] += gain * (d - old)
+                m2[i] += (d - old) * (d - new avg[i] + old - old avg[i])   (unless m2 is null)
+                ring[i] = d
+            With gain = 1/N and evict, d replaces the oldest value in a full window; while the
+            window fills up, gain = 1/k without evict is the plain running mean (Welford).
+            Values are rounded to float first, so the window subtracts exactly what it added.
+        */
+        void slideWindow(double* avg, double* m2, float* ring, const float* x, int n, double gain,
+            bool evict, double shift = 0);
+
+        /** Smallest and largest of each bucket of 8 consecutive values: for b in [0, numBuckets),
+            minima[b] = min(x[8b], ..., x[8b + 7]) (unless minima is null) and maxima[b] = max(...),
+            rounded to float. */
+        void bucketMinMax(const double* x, int numBuckets, float* minima, float* maxima);
+
+        /** Adds the sum of |x[i] - shift| for i in [0, n) to absSum. If the largest
+            |x[i] - shift| is at least peak, sets peak to it and peakIndex to indexOffset + i
+            (the last such i if there are several).
+        */
+        void absSumAndPeak(const float* x, int n, int indexOffset,
+            double& absSum, float& peak, int& peakIndex, float shift = 0);
+
+        /** Name of the instruction set in use ("AVX-512", "AVX2", "SSE2" or "Scalar") */
+        const char* getInstructionSetName();
+    }
+}
+
+#endif // SIMD_KERNELS_H_INCLUDED
@@ -0,0 +1,235 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <cerrno>
+#include <semaphore.h>
+#endif
+
+using namespace RealTimeERP;
+
+// how many times an idle worker checks for a job before going to sleep
+static const int spinCount = 2000;
+
+/*********** Semaphore ***********/
+
+// Counting semaphore; signal() doesn't make a system call unless a thread is waiting
+// (except on Windows), which is why run() also checks numParked first
+struct WorkerPool::Semaphore
+{
+#if defined(_WIN32)
+    HANDLE handle;
+
+    Semaphore() { handle = CreateSemaphoreW(nullptr, 0, MAXLONG, nullptr); }
+    ~Semaphore() { CloseHandle(handle); }
+    void signal(int count) { ReleaseSemaphore(handle, count, nullptr); }
+    void wait() { WaitForSingleObject(handle, INFINITE); }
+#elif defined(__APPLE__)
+    dispatch_semaphore_t semaphore;
+
+    Semaphore() { semaphore = dispatch_semaphore_create(0); }
+    ~Semaphore() { dispatch_release(semaphore); }
+    void signal(int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            dispatch_semaphore_signal(semaphore);
+        }
+    }
+    void wait() { dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER); }
+#else
+    sem_t semaphore;
+
+    Semaphore() { sem_init(&semaphore, 0, 0); }
+    ~Semaphore() { sem_destroy(&semaphore); }
+    void signal(int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            sem_post(&semaphore);
+        }
+    }
+    void wait()
+    {
+        while (sem_wait(&semaphore) != 0 && errno == EINTR) {}
+    }
+#endif
+};
+
+/*********** WorkerPool ***********/
+
+WorkerPool::WorkerPool(int numWorkers)
+    : state         (0)
+    , function      (nullptr)
+    , taskContext   (nullptr)
+    , numCompleted  (0)
+    , quit          (false)
+    , wakeUp        (new Semaphore())
+    , numParked     (0)
+{
+    for (int i = 0; i < numWorkers; ++i)
+    {
+        workers.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    quit.store(true);
+    wakeUp->signal(int(workers.size()));
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+int WorkerPool::getDefaultNumWorkers()
+{
+    int cores = int(std::thread::hardware_concurrency());
+    return std::max(0, std::min(cores - 1, 7));
+}
+
+void WorkerPool::run(int n, TaskFunction fn, void* context)
+{
+    if (n <= 0)
+    {
+        return;
+    }
+
+    if (workers.empty() || n == 1)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            fn(context, i);
+        }
+        return;
+    }
+
+    // The previous job is finished, so nobody is reading these
+    function.store(fn, std::memory_order_relaxed);
+    taskContext.store(context, std::memory_order_relaxed);
+    numCompleted.store(0, std::memory_order_relaxed);
+
+    uint32_t job = uint32_t(state.load(std::memory_order_relaxed) >> 32) + 1;
+    state.store(uint64_t(job) << 32 | uint64_t(n & 0xffff) << 16, std::memory_order_seq_cst);
+
+    // Only wake workers that went to sleep (the others see the job while spinning). A worker
+    // counts itself in numParked before checking for a job one last time, so either it sees
+    // this job or this sees it.
+    if (numParked.load(std::memory_order_seq_cst) > 0)
+    {
+        wakeUp->signal(numParked.exchange(0, std::memory_order_seq_cst));
+    }
+
+    while (runOneTask(job)) {}
+
+    // Every task has been claimed, so this only waits for those running on workers
+    while (numCompleted.load(std::memory_order_acquire) < n)
+    {
+        std::this_thread::yield();
+    }
+}
+
+bool WorkerPool::runOneTask(uint32_t job)
+{
+    uint64_t current = state.load(std::memory_order_acquire);
+    while (true)
+    {
+        if (uint32_t(current >> 32) != job)
+        {
+            return false; // a newer job has started, so this one is done
+        }
+
+        int numTasks = int((current >> 16) & 0xffff);
+        int index = int(current & 0xffff);
+        if (index >= numTasks)
+        {
+            return false;
+        }
+
+        // the job can't change while it has unfinished tasks, so after a successful claim
+        // function and taskContext belong to it
+        if (state.compare_exchange_weak(current, current + 1, std::memory_order_acq_rel))
+        {
+            function.load(std::memory_order_relaxed)(taskContext.load(std::memory_order_relaxed), index);
+            numCompleted.fetch_add(1, std::memory_order_release);
+            return true;
+        }
+    }
+}
+
+void WorkerPool::park(uint32_t lastJob)
+{
+    numParked.fetch_add(1, std::memory_order_seq_cst);
+    if (quit.load() || uint32_t(state.load(std::memory_order_seq_cst) >> 32) != lastJob)
+    {
+        // Don't sleep after all. If run() already counted this worker, it signals once too
+        // often, which only makes a later park() return early.
+        int parked = numParked.load(std::memory_order_relaxed);
+        while (parked > 0 && !numParked.compare_exchange_weak(parked, parked - 1, std::memory_order_relaxed)) {}
+        return;
+    }
+    wakeUp->wait();
+}
+
+void WorkerPool::workerLoop()
+{
+    uint32_t lastJob = 0;
+
+    while (!quit.load())
+    {
+        uint32_t job = uint32_t(state.load(std::memory_order_acquire) >> 32);
+        if (job != lastJob)
+        {
+            while (runOneTask(job)) {}
+            lastJob = job;
+            continue;
+        }
+
+        bool found = false;
+        for (int i = 0; i < spinCount && !found; ++i)
+        {
+            found = uint32_t(state.load(std::memory_order_relaxed) >> 32) != lastJob;
+        }
+
+        if (!found)
+        {
+            park(lastJob);
+        }
+    }
+}
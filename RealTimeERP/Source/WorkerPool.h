@@ -0,0 +1,104 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef WORKER_POOL_H_INCLUDED
+#define WORKER_POOL_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/*
+* Small fork-join pool for splitting the audio thread's work into independent tasks.
+*
+* run(numTasks, fn, context) calls fn(context, i) once for each i in [0, numTasks), spread over
+* the worker threads and the calling thread, and returns when all calls have finished. Since
+* the caller waits, tasks can read data that is only valid during the call (e.g. the current
+* block of samples) without copying it.
+*
+* run() doesn't lock, allocate or (unless a worker is asleep) make system calls. The calling
+* thread takes tasks itself, so every task that no worker has started by the time the caller
+* gets to it runs on the caller: a worker that is slow to wake up or descheduled between tasks
+* can't hold up the job, and the caller only ever waits for tasks that are already running.
+* Splitting the work into several tasks per thread keeps that wait short.
+*
+* Idle workers spin briefly and then sleep on a semaphore until run() wakes them, so an idle
+* pool costs nothing. run() only signals the semaphore when a worker is actually asleep.
+*
+* run() must only be called from one thread at a time.
+*/
+
+namespace RealTimeERP
+{
+    class WorkerPool
+    {
+    public:
+        typedef void (*TaskFunction)(void* context, int taskIndex);
+
+        /** Starts numWorkers threads (may be 0, in which case run() does all tasks itself) */
+        explicit WorkerPool(int numWorkers);
+
+        /** Stops and joins the threads */
+        ~WorkerPool();
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        /** Calls fn(context, i) for i in [0, numTasks) and waits for all calls to finish.
+            numTasks must be less than 65536. */
+        void run(int numTasks, TaskFunction fn, void* context);
+
+        int getNumWorkers() const { return int(workers.size()); }
+
+        /** A reasonable number of workers for this machine (leaving a core for the caller) */
+        static int getDefaultNumWorkers();
+
+    private:
+        void workerLoop();
+
+        // Claims and runs one task of the given job; returns false if there are none left
+        bool runOneTask(uint32_t job);
+
+        // Sleeps until run() starts a job after lastJob (or the pool is destroyed)
+        void park(uint32_t lastJob);
+
+        std::vector<std::thread> workers;
+
+        // Job number (high 32 bits), number of tasks (next 16 bits) and index of the next task to
+        // claim (low 16 bits), in one word so a task can only be claimed from the current job
+        std::atomic<uint64_t> state;
+        std::atomic<TaskFunction> function;
+        std::atomic<void*> taskContext;
+        std::atomic<int> numCompleted;
+
+        std::atomic<bool> quit;
+
+        struct Semaphore; // platform specific
+        std::unique_ptr<Semaphore> wakeUp;
+        std::atomic<int> numParked; // workers that are (about to be) waiting on wakeUp
+    };
+}
+
+#endif // WORKER_POOL_H_INCLUDED
@@ -0,0 +1,289 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+* Headless checks of the epoching and averaging engine (ERPEngine) against what the averages
+* should be for simple synthetic signals. Each test prints its name and whether it passed;
+* the exit code is the number of failures.
+*
+* Usage: ERPEngineTests
+*/
+
+#include "ERPEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+using namespace RealTimeERP;
+
+static int numFailures = 0;
+
+static void report(const char* name, int failuresBefore)
+{
+    std::printf("%s: %s\n", name, numFailures == failuresBefore ? "passed" : "FAILED");
+}
+
+static void check(bool passed, const char* name, const char* what, double value, double expected)
+{
+    if (!passed)
+    {
+        std::printf("  %s: %s is %g, expected %g\n", name, what, value, expected);
+        ++numFailures;
+    }
+}
+
+/*********** Driving the engine ***********/
+
+/*
+* Feeds an engine blocks of a signal (the same on every channel), with a trigger at the given
+* timestamps, and keeps track of the timestamp.
+*/
+class SignalDriver
+{
+public:
+    SignalDriver(ERPEngine& e, int channels, int block, std::function<float(int64_t)> f)
+        : engine        (e)
+        , signal        (f)
+        , blockSize     (block)
+        , timestamp     (0)
+        , samples       (channels, std::vector<float>(block))
+        , pointers      (channels)
+    {
+        for (int n = 0; n < channels; n++)
+        {
+            pointers[n] = samples[n].data();
+        }
+    }
+
+    /** Processes blocks until the timestamp reaches end, with triggers at every timestamp
+        in [first, end) that is a multiple of spacing */
+    void run(int64_t end, int64_t first = -1, int64_t spacing = 0)
+    {
+        while (timestamp < end)
+        {
+            for (int64_t t = first; spacing > 0 && t < timestamp + blockSize && t < end; t += spacing)
+            {
+                if (t >= timestamp)
+                {
+                    engine.addEvent(0, t);
+                }
+            }
+            for (auto& channel : samples)
+            {
+                for (int i = 0; i < blockSize; i++)
+                {
+                    channel[i] = signal(timestamp + i);
+                }
+            }
+            engine.processBlock(pointers.data(), blockSize, timestamp);
+            timestamp += blockSize;
+        }
+    }
+
+private:
+    ERPEngine& engine;
+    std::function<float(int64_t)> signal;
+    int blockSize;
+    int64_t timestamp;
+    std::vector<std::vector<float>> samples;
+    std::vector<const float*> pointers;
+};
+
+// Largest difference between the average of trigger 0 and the expected waveform
+static double maxError(const ERPEngine& engine, int channels, std::function<double(int)> expected)
+{
+    const AccumulatorStore& lfp = engine.getAverages().lfp;
+    double error = 0;
+    for (int n = 0; n < channels; n++)
+    {
+        for (int s = 0; s < lfp.getNumSamples(); s++)
+        {
+            error = std::max(error, std::fabs(lfp.getAverage(0, n, s) - expected(s)));
+        }
+    }
+    return error;
+}
+
+// Largest difference between the envelope of trigger 0 and the minima and maxima of its average
+// over each bucket (where buckets past the valid ones must stand for zeros)
+static double maxEnvelopeError(const ERPSnapshot& snapshot, int channels)
+{
+    const AccumulatorStore& lfp = snapshot.lfp;
+    const EnvelopePyramid& envelope = snapshot.envelope;
+    double error = 0;
+    for (int n = 0; n < channels; n++)
+    {
+        for (int level = 0; level < envelope.getNumLevels(); level++)
+        {
+            int size = envelope.getBucketSize(level);
+            int numValid = envelope.getNumValidBuckets(0, level);
+            for (int b = 0; b < envelope.getNumBuckets(level); b++)
+            {
+                double lo = lfp.getAverage(0, n, b * size);
+                double hi = lo;
+                for (int s = b * size; s < std::min((b + 1) * size, lfp.getNumSamples()); s++)
+                {
+                    lo = std::min(lo, lfp.getAverage(0, n, s));
+                    hi = std::max(hi, lfp.getAverage(0, n, s));
+                }
+                double bucketMin = b < numValid ? envelope.getMin(0, n, level)[b] : 0.0;
+                double bucketMax = b < numValid ? envelope.getMax(0, n, level)[b] : 0.0;
+                error = std::max(error, std::max(std::fabs(bucketMin - lo), std::fabs(bucketMax - hi)));
+            }
+        }
+    }
+    return error;
+}
+
+/*********** Tests ***********/
+
+// Going through instantaneous mode and back must leave a "last N" window consistent
+static void testWindowAfterInstantaneous()
+{
+    const char* name = "window after instantaneous";
+    int failuresBefore = numFailures;
+    ERPEngine engine;
+    engine.configure(1, 2, 100, 0, 0, 0, -1, 4);
+
+    // Fewer instantaneous epochs than the window and different levels in each phase, so
+    // a window that kept the epochs from before would show
+    float level = 5;
+    SignalDriver driver(engine, 2, 200, [&level](int64_t) { return level; });
+    driver.run(2000, 0, 200);
+    engine.setReplace(true);
+    level = 9;
+    driver.run(2200, 2000, 200);
+    engine.setReplace(false);
+    level = 1;
+    driver.run(4600, 2200, 200); // 12 epochs
+    check(maxError(engine, 2, [](int) { return 1.0; }) < 1e-6, name, "average",
+        engine.getAverages().lfp.getAverage(0, 0, 50), 1);
+    report(name, failuresBefore);
+}
+
+// The baseline is the mean of the pre-trigger window wherever the blocks split it, including
+// blocks longer than the pre-trigger window and history
+static void testBaselineWithLongBlocks()
+{
+    const char* name = "baseline with long blocks";
+    int failuresBefore = numFailures;
+
+    // A ramp of 100 samples after each trigger (every 700 samples) on a DC offset of 100
+    const int pre = 50;
+    const int spacing = 700;
+    auto signal = [](int64_t t) { return float(100 + (t % spacing < 100 ? t % spacing : 0)); };
+    auto expected = [](int s) { return s >= pre && s < pre + 100 ? double(s - pre) : 0.0; };
+
+    for (int blockSize : { 256, 1500, 3000 })
+    {
+        ERPEngine engine;
+        engine.configure(1, 3, 300, pre, 0, 0);
+        SignalDriver driver(engine, 3, blockSize, signal);
+        driver.run(60000, spacing, spacing);
+        check(maxError(engine, 3, expected) < 1e-4, name, "error", maxError(engine, 3, expected), 0);
+    }
+    report(name, failuresBefore);
+}
+
+// After a reset, the envelope must describe the new averages only, without clearing its buckets
+static void testEnvelopeAfterReset()
+{
+    const char* name = "envelope after reset";
+    int failuresBefore = numFailures;
+    ERPEngine engine;
+    engine.configure(1, 2, 5000, 0, 0, 0);
+
+    // Large values first, so any left over would show; then a ramp over part of the epoch
+    float level = 50;
+    SignalDriver driver(engine, 2, 512, [&level](int64_t t) { return t % 6000 < 1000 ? level * (t % 6000) / 1000.0f : 0.0f; });
+    driver.run(24000, 0, 6000);
+    engine.reset();
+    level = 10;
+    driver.run(36000, 24000, 6000);
+    check(maxEnvelopeError(engine.getAverages(), 2) < 1e-4, name, "envelope error", maxEnvelopeError(engine.getAverages(), 2), 0);
+
+    // A copy only takes the valid buckets
+    ERPSnapshot copy;
+    copy.resize(1, 2, 5000, 0);
+    copy.copyChangedFrom(engine.getAverages());
+    engine.reset();
+    copy.copyChangedFrom(engine.getAverages());
+    check(maxEnvelopeError(copy, 2) < 1e-4, name, "copied envelope error", maxEnvelopeError(copy, 2), 0);
+    report(name, failuresBefore);
+}
+
+// Part way through an epoch, an updated envelope must match the averages folded so far
+static void testEnvelopeOfPartialEpoch()
+{
+    const char* name = "envelope of a partial epoch";
+    int failuresBefore = numFailures;
+    ERPEngine engine;
+    engine.configure(1, 2, 5000, 0, 0, 0);
+
+    SignalDriver driver(engine, 2, 300, [](int64_t t) { return float(t % 6000) / 100 - 10; });
+    driver.run(6000, 0, 6000);
+    engine.reset();
+    driver.run(8700, 6000, 6000); // (2700 of 5000 samples)
+    engine.updateEnvelope();
+    check(engine.getAverages().lfp.getValidSamples(0) == 2700, name, "valid samples",
+        engine.getAverages().lfp.getValidSamples(0), 2700);
+    check(maxEnvelopeError(engine.getAverages(), 2) < 1e-4, name, "envelope error", maxEnvelopeError(engine.getAverages(), 2), 0);
+    report(name, failuresBefore);
+}
+
+// Epochs left open when acquisition stops must not hold up the next one, whose timestamps
+// start over
+static void testRestartedTimestamps()
+{
+    const char* name = "restarted timestamps";
+    int failuresBefore = numFailures;
+    ERPEngine engine;
+    engine.configure(1, 2, 100, 10, 0, 0);
+
+    // Stop with an epoch waiting for later samples
+    SignalDriver first(engine, 2, 256, [](int64_t) { return 1.0f; });
+    engine.addEvent(0, 50000);
+    first.run(1024, 200, 200);
+    uint64_t before = engine.getAverages().epochCount[0];
+
+    engine.clearOpenEpochs();
+    SignalDriver second(engine, 2, 256, [](int64_t) { return 1.0f; });
+    second.run(20480, 200, 200);
+    uint64_t after = engine.getAverages().epochCount[0];
+    check(after - before == 101, name, "epochs after restarting", double(after - before), 101);
+    check(engine.getNumDroppedEvents(0) == 0, name, "dropped events", double(engine.getNumDroppedEvents(0)), 0);
+    report(name, failuresBefore);
+}
+
+int main()
+{
+    testWindowAfterInstantaneous();
+    testBaselineWithLongBlocks();
+    testEnvelopeAfterReset();
+    testEnvelopeOfPartialEpoch();
+    testRestartedTimestamps();
+    return numFailures;
+}